@@ -0,0 +1,98 @@
+///
+/// Contains a type to await script runs from C++20 coroutines
+/// Only available if the library and the code including it are built with PYTHON_CPP_UTILITY_COROUTINES defined, see the PYTHON_SCRIPT_UTIL_COROUTINES build option
+///
+
+#ifndef PYTHON_CPP_UTILITY_AWAITABLE_H
+#define	PYTHON_CPP_UTILITY_AWAITABLE_H
+
+#if PYTHON_CPP_UTILITY_COROUTINES
+
+#include "Run.h"
+#include "Scheduler.h"
+#include "Completion.h"
+
+#include <coroutine>
+#include <exception>
+
+namespace PythonCppUtility {
+
+    ///
+    /// An awaitable script run, returned by ScriptSystem::run()
+    /// The run is submitted when the awaiting coroutine suspends, the coroutine is resumed by the worker thread that executed the run after it released the GIL
+    /// Awaiting the run rethrows the error of the run, e.g. a python error, an exception of a callback or RunCancelledError
+    /// A run that is never awaited is never executed
+    ///
+    class RunAwaitable {
+    public:
+
+        ///
+        /// Creates a new awaitable
+        /// Should only be called by the script system
+        /// \param scheduler the scheduler to submit the run to
+        /// \param pool the pool to allocate the run's completion from
+        /// \param run the run, the awaitable takes ownership until it is submitted
+        ///
+        RunAwaitable(Scheduler &scheduler, MemoryPoolRef pool, Run *run) : scheduler_(scheduler), pool_(std::move(pool)), run_(run), error_(){}
+
+        RunAwaitable(RunAwaitable &&awaitable) : scheduler_(awaitable.scheduler_), pool_(std::move(awaitable.pool_)), run_(awaitable.run_), error_(){
+            awaitable.run_ = nullptr;
+        }
+
+        ///
+        /// \return false, the run always has to be submitted
+        ///
+        bool await_ready() const noexcept{
+            return false;
+        }
+
+        ///
+        /// Submits the run, the coroutine is resumed when it finished
+        /// \param coroutine the awaiting coroutine
+        ///
+        void await_suspend(std::coroutine_handle<> coroutine){
+            Run *run = run_;
+            run_ = nullptr;
+            Completion completion{pool_};
+            completion.then([this, coroutine](std::exception_ptr error){
+                error_ = error;
+                coroutine.resume();
+            });
+            run->completion(completion);
+            scheduler_.submit(run);
+        }
+
+        ///
+        /// \throw the error of the run, if any
+        ///
+        void await_resume(){
+            if(error_){
+                std::rethrow_exception(error_);
+            }
+        }
+
+        ///
+        /// Destroys the run if it was never submitted
+        ///
+        ~RunAwaitable(){
+            if(run_){
+                Run::destroy(run_);
+            }
+        }
+
+    private:
+        Scheduler &scheduler_;
+        MemoryPoolRef pool_;
+        Run *run_;
+        std::exception_ptr error_;
+
+        RunAwaitable(const RunAwaitable &) = delete;
+        RunAwaitable &operator=(const RunAwaitable &) = delete;
+    };
+
+}
+
+#endif
+
+#endif	/* PYTHON_CPP_UTILITY_AWAITABLE_H */
+
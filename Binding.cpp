@@ -0,0 +1,44 @@
+#include "Binding.h"
+
+using namespace PythonCppUtility;
+
+using namespace std;
+
+BindingKeys::BindingKeys() : mutex_(), names_(), keys_(), version_(0){}
+
+size_t BindingKeys::add(const string &name){
+    lock_guard<mutex> lock{mutex_};
+    names_.push_back(name);
+    ++version_;
+    return names_.size() - 1;
+}
+
+boost::python::object BindingKeys::get(){
+    using namespace boost::python;
+    size_t version;
+    vector<string> names;
+    {
+        lock_guard<mutex> lock{mutex_};
+        if(!keys_.empty(version_)){
+            return keys_.get(version_);
+        }
+        version = version_;
+        names = names_;
+    }
+    // Create the keys without holding the lock: allocating them may run the garbage collector, which can release the GIL
+    handle<> keys{PyTuple_New(static_cast<Py_ssize_t>(names.size()))};
+    for(size_t i = 0; i < names.size(); ++i){
+        // Interned keys are compared by identity and carry their hash, so dictionary lookups do not hash or compare the characters
+        PyTuple_SET_ITEM(keys.get(), static_cast<Py_ssize_t>(i), handle<>{PyUnicode_InternFromString(names[i].c_str())}.release());
+    }
+    object created{keys};
+    lock_guard<mutex> lock{mutex_};
+    if(version_ == version){
+        // Another thread of the interpreter may have created the keys meanwhile, all threads should share one tuple
+        if(!keys_.empty(version)){
+            return keys_.get(version);
+        }
+        keys_.set(created, version);
+    }
+    return created;
+}
@@ -0,0 +1,355 @@
+///
+/// Contains a declarative binding of C++ struct fields to the names of a script's arguments and results
+///
+
+#ifndef PYTHON_CPP_UTILITY_BINDING_H
+#define	PYTHON_CPP_UTILITY_BINDING_H
+
+#include "CachedObject.h"
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <boost/python.hpp>
+
+namespace PythonCppUtility {
+
+    ///
+    /// Converts values between C++ and python for a Binding
+    /// Integers, floating point numbers, booleans, strings and vectors of these are converted by the python C API directly, all other types use boost::python's converters
+    /// Should only be used while the GIL is held
+    /// \tparam T the C++ type
+    ///
+    template<typename T, typename = void> struct BindingConverter {
+        ///
+        /// \param value the value to convert
+        /// \throw boost::python::error_already_set if the value could not be converted
+        /// \return a new reference to the python object
+        ///
+        static PyObject *to_python(const T &value){
+            return boost::python::incref(boost::python::object{value}.ptr());
+        }
+
+        ///
+        /// \param object the python object to convert, a borrowed reference
+        /// \param value the value to set
+        /// \throw boost::python::error_already_set if the object could not be converted
+        ///
+        static void from_python(PyObject *object, T &value){
+            value = boost::python::extract<T>(object);
+        }
+    };
+
+    template<typename T> struct BindingConverter<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type> {
+        static PyObject *to_python(const T &value){
+            return boost::python::handle<>{PyLong_FromLongLong(value)}.release();
+        }
+
+        static void from_python(PyObject *object, T &value){
+            long long converted = PyLong_AsLongLong(object);
+            if(converted == -1 && PyErr_Occurred()){
+                boost::python::throw_error_already_set();
+            }
+            if(converted < std::numeric_limits<T>::min() || converted > std::numeric_limits<T>::max()){
+                PyErr_SetString(PyExc_OverflowError, "the integer is out of the range of the bound field");
+                boost::python::throw_error_already_set();
+            }
+            value = static_cast<T>(converted);
+        }
+    };
+
+    template<typename T> struct BindingConverter<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value && !std::is_same<T, bool>::value>::type> {
+        static PyObject *to_python(const T &value){
+            return boost::python::handle<>{PyLong_FromUnsignedLongLong(value)}.release();
+        }
+
+        static void from_python(PyObject *object, T &value){
+            unsigned long long converted = PyLong_AsUnsignedLongLong(object);
+            if(converted == static_cast<unsigned long long>(-1) && PyErr_Occurred()){
+                boost::python::throw_error_already_set();
+            }
+            if(converted > std::numeric_limits<T>::max()){
+                PyErr_SetString(PyExc_OverflowError, "the integer is out of the range of the bound field");
+                boost::python::throw_error_already_set();
+            }
+            value = static_cast<T>(converted);
+        }
+    };
+
+    template<> struct BindingConverter<bool> {
+        static PyObject *to_python(const bool &value){
+            return boost::python::handle<>{PyBool_FromLong(value)}.release();
+        }
+
+        static void from_python(PyObject *object, bool &value){
+            int converted = PyObject_IsTrue(object);
+            if(converted < 0){
+                boost::python::throw_error_already_set();
+            }
+            value = converted != 0;
+        }
+    };
+
+    template<typename T> struct BindingConverter<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+        static PyObject *to_python(const T &value){
+            return boost::python::handle<>{PyFloat_FromDouble(value)}.release();
+        }
+
+        static void from_python(PyObject *object, T &value){
+            double converted = PyFloat_AsDouble(object);
+            if(converted == -1.0 && PyErr_Occurred()){
+                boost::python::throw_error_already_set();
+            }
+            value = static_cast<T>(converted);
+        }
+    };
+
+    template<> struct BindingConverter<std::string> {
+        static PyObject *to_python(const std::string &value){
+            return boost::python::handle<>{PyUnicode_FromStringAndSize(value.data(), static_cast<Py_ssize_t>(value.size()))}.release();
+        }
+
+        static void from_python(PyObject *object, std::string &value){
+            if(PyBytes_Check(object)){
+                value.assign(PyBytes_AS_STRING(object), static_cast<std::size_t>(PyBytes_GET_SIZE(object)));
+                return;
+            }
+            Py_ssize_t size;
+            const char *data = PyUnicode_AsUTF8AndSize(object, &size);
+            if(!data){
+                boost::python::throw_error_already_set();
+            }
+            value.assign(data, static_cast<std::size_t>(size));
+        }
+    };
+
+    template<typename T, typename Allocator> struct BindingConverter<std::vector<T, Allocator>> {
+        static PyObject *to_python(const std::vector<T, Allocator> &value){
+            boost::python::handle<> list{PyList_New(static_cast<Py_ssize_t>(value.size()))};
+            for(std::size_t i = 0; i < value.size(); ++i){
+                PyList_SET_ITEM(list.get(), static_cast<Py_ssize_t>(i), BindingConverter<T>::to_python(value[i]));
+            }
+            return list.release();
+        }
+
+        static void from_python(PyObject *object, std::vector<T, Allocator> &value){
+            boost::python::handle<> sequence{PySequence_Fast(object, "the bound field expects a sequence")};
+            Py_ssize_t size = PySequence_Fast_GET_SIZE(sequence.get());
+            PyObject **items = PySequence_Fast_ITEMS(sequence.get());
+            value.clear();
+            value.reserve(static_cast<std::size_t>(size));
+            for(Py_ssize_t i = 0; i < size; ++i){
+                T item{};
+                BindingConverter<T>::from_python(items[i], item);
+                value.push_back(std::move(item));
+            }
+        }
+    };
+
+    ///
+    /// The interned key objects of a binding's names, created once per interpreter
+    /// This type is thread safe
+    ///
+    class BindingKeys {
+    public:
+
+        ///
+        /// Creates an empty set of keys
+        ///
+        BindingKeys();
+
+        ///
+        /// Adds a name, keys that were already created are created again on next use
+        /// \param name the name
+        /// \return the index of the name's key
+        ///
+        std::size_t add(const std::string &name);
+
+        ///
+        /// Should only be called while the GIL is held
+        /// \return a tuple of the interned keys for the calling thread's interpreter, in the order the names were added
+        ///
+        boost::python::object get();
+
+    private:
+        std::mutex mutex_;
+        std::vector<std::string> names_;
+        CachedObject keys_;
+        std::size_t version_;
+
+        BindingKeys(const BindingKeys &) = delete;
+        BindingKeys &operator=(const BindingKeys &) = delete;
+    };
+
+    ///
+    /// Maps the fields of a C++ struct to the names of a script's arguments in the local dictionary and of it's results, e.g.
+    ///
+    ///     Binding<Order> binding;
+    ///     binding.argument("quantity", &Order::quantity).argument("price", &Order::price).result("total", &Order::total);
+    ///     system.execute(source, binding.before(order), binding.after(order));
+    ///
+    /// The binding is declared once and used for any number of runs, each run only converts the fields and stores them under pre-interned keys
+    /// Fields should be declared before the binding is used, the binding must outlive the runs using it's callbacks
+    /// Using the binding is thread safe
+    /// \tparam T the struct type
+    ///
+    template<typename T> class Binding {
+    public:
+
+        ///
+        /// A before callback that puts the arguments of a value into the local dictionary
+        ///
+        class Before {
+        public:
+            Before(const Binding &binding, const T &value) : binding_(&binding), value_(&value){}
+
+            void operator() (boost::python::object locals) const{
+                binding_->put(*value_, locals);
+            }
+
+        private:
+            const Binding *binding_;
+            const T *value_;
+        };
+
+        ///
+        /// An after callback that reads the results from the local dictionary into a value
+        ///
+        class After {
+        public:
+            After(const Binding &binding, T &value) : binding_(&binding), value_(&value){}
+
+            void operator() (boost::python::object locals) const{
+                binding_->get(*value_, locals);
+            }
+
+        private:
+            const Binding *binding_;
+            T *value_;
+        };
+
+        ///
+        /// Creates a binding without fields
+        ///
+        Binding() : keys_(), arguments_(), results_(){}
+
+        ///
+        /// Declares a field that is passed to the script
+        /// \tparam Member the type of the field, see BindingConverter
+        /// \param name the name of the argument in the local dictionary
+        /// \param member the field
+        /// \return this binding
+        ///
+        template<typename Member> Binding &argument(const std::string &name, Member T::*member){
+            arguments_.emplace_back(new MemberField<Member>{keys_.add(name), member});
+            return *this;
+        }
+
+        ///
+        /// Declares a field that is read from the script's local dictionary after it ran
+        /// \tparam Member the type of the field, see BindingConverter
+        /// \param name the name of the result in the local dictionary
+        /// \param member the field
+        /// \return this binding
+        ///
+        template<typename Member> Binding &result(const std::string &name, Member T::*member){
+            results_.emplace_back(new MemberField<Member>{keys_.add(name), member});
+            return *this;
+        }
+
+        ///
+        /// Puts the arguments into a local dictionary
+        /// Should only be called while the GIL is held
+        /// \param value the value to read the arguments from
+        /// \param locals the local dictionary
+        /// \throw boost::python::error_already_set if an argument could not be converted
+        ///
+        void put(const T &value, boost::python::object locals) const{
+            boost::python::object keys = keys_.get();
+            for(const std::unique_ptr<Field> &field : arguments_){
+                boost::python::handle<> item{field->to_python(value)};
+                if(PyDict_SetItem(locals.ptr(), PyTuple_GET_ITEM(keys.ptr(), field->key), item.get()) < 0){
+                    boost::python::throw_error_already_set();
+                }
+            }
+        }
+
+        ///
+        /// Reads the results from a local dictionary
+        /// Should only be called while the GIL is held
+        /// \param value the value to set the results of
+        /// \param locals the local dictionary
+        /// \throw boost::python::error_already_set if a result is missing (KeyError) or could not be converted
+        ///
+        void get(T &value, boost::python::object locals) const{
+            boost::python::object keys = keys_.get();
+            for(const std::unique_ptr<Field> &field : results_){
+                PyObject *key = PyTuple_GET_ITEM(keys.ptr(), field->key);
+                PyObject *item = PyDict_GetItemWithError(locals.ptr(), key);
+                if(!item){
+                    if(!PyErr_Occurred()){
+                        PyErr_SetObject(PyExc_KeyError, key);
+                    }
+                    boost::python::throw_error_already_set();
+                }
+                field->from_python(item, value);
+            }
+        }
+
+        ///
+        /// \param value the value to read the arguments from, must live until the run ended
+        /// \return a before callback that puts the arguments into the local dictionary
+        ///
+        Before before(const T &value) const{
+            return Before{*this, value};
+        }
+
+        ///
+        /// \param value the value to set the results of, must live until the run ended
+        /// \return an after callback that reads the results from the local dictionary
+        ///
+        After after(T &value) const{
+            return After{*this, value};
+        }
+
+    private:
+        struct Field {
+            explicit Field(std::size_t key) : key(key){}
+            virtual ~Field(){}
+            virtual PyObject *to_python(const T &value) const = 0;
+            virtual void from_python(PyObject *object, T &value) const = 0;
+
+            std::size_t key;
+        };
+
+        template<typename Member> struct MemberField : Field {
+            MemberField(std::size_t key, Member T::*member) : Field(key), member(member){}
+
+            PyObject *to_python(const T &value) const override{
+                return BindingConverter<Member>::to_python(value.*member);
+            }
+
+            void from_python(PyObject *object, T &value) const override{
+                BindingConverter<Member>::from_python(object, value.*member);
+            }
+
+            Member T::*member;
+        };
+
+        mutable BindingKeys keys_;
+        std::vector<std::unique_ptr<Field>> arguments_;
+        std::vector<std::unique_ptr<Field>> results_;
+
+        Binding(const Binding &) = delete;
+        Binding &operator=(const Binding &) = delete;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_BINDING_H */
+
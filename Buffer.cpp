@@ -0,0 +1,195 @@
+#include "Buffer.h"
+#include "CachedObject.h"
+
+#include <mutex>
+
+using namespace PythonCppUtility;
+
+using namespace std;
+
+namespace{
+    ///
+    /// The python object exporting the C++ memory, every memoryview of it and every slice of these views holds one of it's exports
+    ///
+    struct Exporter {
+        PyObject_HEAD
+        void *data;
+        Py_ssize_t size;
+        Py_ssize_t item_size;
+        const char *format;
+        bool writable;
+        bool released;
+        Py_ssize_t exports;
+    };
+
+    int exporter_get_buffer(PyObject *object, Py_buffer *view, int flags){
+        Exporter *exporter = reinterpret_cast<Exporter *>(object);
+        if(exporter->released){
+            PyErr_SetString(PyExc_BufferError, "the buffer was released at the end of the script run");
+            return -1;
+        }
+        if((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE && !exporter->writable){
+            PyErr_SetString(PyExc_BufferError, "the buffer is read-only");
+            return -1;
+        }
+        view->buf = exporter->data;
+        view->obj = object;
+        Py_INCREF(object);
+        view->len = exporter->size * exporter->item_size;
+        view->itemsize = exporter->item_size;
+        view->readonly = exporter->writable ? 0 : 1;
+        view->ndim = 1;
+        view->format = (flags & PyBUF_FORMAT) == PyBUF_FORMAT ? const_cast<char *>(exporter->format) : nullptr;
+        view->shape = (flags & PyBUF_ND) == PyBUF_ND ? &exporter->size : nullptr;
+        view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &exporter->item_size : nullptr;
+        view->suboffsets = nullptr;
+        view->internal = nullptr;
+        ++exporter->exports;
+        return 0;
+    }
+
+    void exporter_release_buffer(PyObject *object, Py_buffer *){
+        --reinterpret_cast<Exporter *>(object)->exports;
+    }
+
+    PyType_Slot exporter_slots[] = {
+#if PY_VERSION_HEX >= 0x03090000
+        {Py_bf_getbuffer, reinterpret_cast<void *>(exporter_get_buffer)},
+        {Py_bf_releasebuffer, reinterpret_cast<void *>(exporter_release_buffer)},
+#endif
+        {Py_tp_doc, const_cast<char *>("C++ memory exposed to a script run")},
+        {0, nullptr}
+    };
+
+#if PY_VERSION_HEX >= 0x030A0000
+    PyType_Spec exporter_spec = {"PythonCppUtility.BufferExporter", sizeof(Exporter), 0, Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, exporter_slots};
+#else
+    PyType_Spec exporter_spec = {"PythonCppUtility.BufferExporter", sizeof(Exporter), 0, Py_TPFLAGS_DEFAULT, exporter_slots};
+#endif
+
+    ///
+    /// The exporter type of each interpreter, types can not be shared between sub-interpreters with their own GIL
+    /// Never destroyed, so it can not outlive the bookkeeping of CachedObject at exit
+    ///
+    struct ExporterTypes {
+        std::mutex mutex;
+        CachedObject types;
+    };
+
+    ExporterTypes &exporter_types(){
+        static ExporterTypes *types = new ExporterTypes{};
+        return *types;
+    }
+
+    ///
+    /// Creates the exporter type of the calling thread's interpreter on first use, should be called while the GIL is held
+    ///
+    PyTypeObject *exporter_type(){
+        using namespace boost::python;
+        ExporterTypes &types = exporter_types();
+        {
+            lock_guard<mutex> lock{types.mutex};
+            if(!types.types.empty()){
+                return reinterpret_cast<PyTypeObject *>(types.types.get().ptr());
+            }
+        }
+        // Create the type without holding the lock: creating it may run the garbage collector, which can release the GIL
+        object created{handle<>{PyType_FromSpec(&exporter_spec)}};
+#if PY_VERSION_HEX < 0x03090000
+        // Older type specs can not define the buffer slots, a heap type keeps them in it's own storage
+        PyHeapTypeObject *heap_type = reinterpret_cast<PyHeapTypeObject *>(created.ptr());
+        heap_type->as_buffer.bf_getbuffer = exporter_get_buffer;
+        heap_type->as_buffer.bf_releasebuffer = exporter_release_buffer;
+#endif
+        lock_guard<mutex> lock{types.mutex};
+        if(types.types.empty()){
+            types.types.set(created);
+        }
+        return reinterpret_cast<PyTypeObject *>(types.types.get().ptr());
+    }
+
+    ///
+    /// The innermost scope of the calling thread, views can only be created while a scope exists
+    ///
+    thread_local BufferView::Scope *current_scope = nullptr;
+}
+
+BufferExportedError::BufferExportedError(const Source::Id &id) : SourceError(id, string{"a buffer view was kept after the script run ended: "} + id){}
+
+boost::python::object BufferView::of(const string &data){
+    return create(const_cast<char *>(data.data()), data.size(), 1, "B", false);
+}
+
+boost::python::object BufferView::writable(string &data){
+    return create(&data[0], data.size(), 1, "B", true);
+}
+
+boost::python::object BufferView::create(void *data, size_t size, size_t item_size, const char *format, bool writable){
+    using namespace boost::python;
+    if(!current_scope){
+        throw ScriptError{"buffer views can only be created by the callbacks of a script run"};
+    }
+    PyTypeObject *type = exporter_type();
+    // Allocating through the type keeps the heap type alive as long as the exporter
+    Exporter *exporter = reinterpret_cast<Exporter *>(type->tp_alloc(type, 0));
+    if(!exporter){
+        throw_error_already_set();
+    }
+    exporter->data = data;
+    exporter->size = static_cast<Py_ssize_t>(size);
+    exporter->item_size = static_cast<Py_ssize_t>(item_size);
+    exporter->format = format;
+    exporter->writable = writable;
+    exporter->released = false;
+    exporter->exports = 0;
+    handle<> exporter_handle{reinterpret_cast<PyObject *>(exporter)};
+    object view{handle<>{PyMemoryView_FromObject(exporter_handle.get())}};
+    current_scope->views_.push_back(Scope::View{incref(view.ptr()), incref(exporter_handle.get())});
+    return view;
+}
+
+BufferView::Scope::Scope() : previous_(current_scope), views_(){
+    current_scope = this;
+}
+
+void BufferView::Scope::release(const Source::Id &id){
+    if(!release_views()){
+        throw BufferExportedError{id};
+    }
+}
+
+bool BufferView::Scope::release_views(){
+    current_scope = previous_;
+    if(views_.empty()){
+        return true;
+    }
+    // The run may be failing with a python error, which must survive calling into python here
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    bool released = true;
+    for(View &view : views_){
+        // Releasing the view makes it raise on use, it only fails if the script still uses memory exported by the view itself
+        PyObject *result = PyObject_CallMethod(view.view, "release", nullptr);
+        if(result){
+            Py_DECREF(result);
+        }else{
+            PyErr_Clear();
+        }
+        Exporter *exporter = reinterpret_cast<Exporter *>(view.exporter);
+        exporter->released = true;
+        if(exporter->exports != 0){
+            released = false;
+        }
+        Py_DECREF(view.view);
+        Py_DECREF(view.exporter);
+    }
+    views_.clear();
+    PyErr_Restore(type, value, traceback);
+    return released;
+}
+
+BufferView::Scope::~Scope(){
+    if(current_scope == this){
+        release_views();
+    }
+}
@@ -0,0 +1,189 @@
+///
+/// Contains a helper to pass contiguous C++ memory to scripts as memoryview without copying it
+///
+
+#ifndef PYTHON_CPP_UTILITY_BUFFER_H
+#define	PYTHON_CPP_UTILITY_BUFFER_H
+
+#include "Source.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <boost/python.hpp>
+
+namespace PythonCppUtility {
+
+    ///
+    /// Provides the struct module format code of an element type for the buffer protocol
+    /// Only specialised for the arithmetic types python's memoryview supports, char is exposed as unsigned bytes
+    /// \tparam T the element type
+    ///
+    template<typename T> struct BufferFormat;
+
+    template<> struct BufferFormat<char> { static const char *format(){ return "B"; } };
+    template<> struct BufferFormat<signed char> { static const char *format(){ return "b"; } };
+    template<> struct BufferFormat<unsigned char> { static const char *format(){ return "B"; } };
+    template<> struct BufferFormat<bool> { static const char *format(){ return "?"; } };
+    template<> struct BufferFormat<short> { static const char *format(){ return "h"; } };
+    template<> struct BufferFormat<unsigned short> { static const char *format(){ return "H"; } };
+    template<> struct BufferFormat<int> { static const char *format(){ return "i"; } };
+    template<> struct BufferFormat<unsigned int> { static const char *format(){ return "I"; } };
+    template<> struct BufferFormat<long> { static const char *format(){ return "l"; } };
+    template<> struct BufferFormat<unsigned long> { static const char *format(){ return "L"; } };
+    template<> struct BufferFormat<long long> { static const char *format(){ return "q"; } };
+    template<> struct BufferFormat<unsigned long long> { static const char *format(){ return "Q"; } };
+    template<> struct BufferFormat<float> { static const char *format(){ return "f"; } };
+    template<> struct BufferFormat<double> { static const char *format(){ return "d"; } };
+
+    ///
+    /// An error that fails a run if a script kept a view of one of the run's buffers after the run ended, e.g. a slice of it stored in a global
+    /// The memory of the buffer may be freed once the run's future returned, so the kept view must not be used, see BufferView
+    ///
+    class BufferExportedError : public SourceError {
+    public:
+
+        ///
+        /// Creates a new error
+        /// \param id the ID of the source of the run
+        ///
+        BufferExportedError(const Source::Id &id);
+    };
+
+    ///
+    /// Creates memoryview objects that reference C++ memory instead of copying it into python objects, e.g. to pass large arrays as arguments
+    /// Views can only be created while the GIL is held by a run's before or after callback, they are released when the run ends so the memory only has to live until the run's future returns
+    /// A released view raises a ValueError when it is used. Views can not be passed to worker processes
+    ///
+    /// Warning: slices of a view, and other objects sharing it's memory, can not be released. If a script keeps one, e.g. in a global, the run fails with BufferExportedError
+    /// but the kept object still points at the C++ memory and stays reachable from the source's namespace. Any later run using it reads or writes memory that may have been freed
+    /// Scripts must not keep such objects beyond their run. After a BufferExportedError, the source's namespace should be replaced (see Source::setup_code()) before the source runs again
+    ///
+    class BufferView {
+    public:
+
+        ///
+        /// Creates a read-only view of an array
+        /// \tparam T the element type, see BufferFormat
+        /// \param data the first element
+        /// \param size the number of elements
+        /// \throw ScriptError if no run is executed by the calling thread
+        /// \return a memoryview of the elements with the element type's format
+        ///
+        template<typename T> static boost::python::object of(const T *data, std::size_t size){
+            return create(const_cast<T *>(data), size, sizeof(T), BufferFormat<T>::format(), false);
+        }
+
+        ///
+        /// Creates a read-only view of a vector's elements, the vector must not be resized until the run ended
+        /// \tparam T the element type, see BufferFormat
+        /// \param data the vector
+        /// \throw ScriptError if no run is executed by the calling thread
+        /// \return a memoryview of the elements
+        ///
+        template<typename T, typename Allocator> static boost::python::object of(const std::vector<T, Allocator> &data){
+            return of(data.data(), data.size());
+        }
+
+        ///
+        /// Creates a read-only view of a string's bytes, the string must not be modified until the run ended
+        /// \param data the string
+        /// \throw ScriptError if no run is executed by the calling thread
+        /// \return a memoryview of the bytes with format "B"
+        ///
+        static boost::python::object of(const std::string &data);
+
+        ///
+        /// Creates a view of an array that scripts can write to
+        /// \tparam T the element type, see BufferFormat
+        /// \param data the first element
+        /// \param size the number of elements
+        /// \throw ScriptError if no run is executed by the calling thread
+        /// \return a writable memoryview of the elements
+        ///
+        template<typename T> static boost::python::object writable(T *data, std::size_t size){
+            return create(data, size, sizeof(T), BufferFormat<T>::format(), true);
+        }
+
+        ///
+        /// Creates a view of a vector's elements that scripts can write to, the vector must not be resized until the run ended
+        /// \tparam T the element type, see BufferFormat
+        /// \param data the vector
+        /// \throw ScriptError if no run is executed by the calling thread
+        /// \return a writable memoryview of the elements
+        ///
+        template<typename T, typename Allocator> static boost::python::object writable(std::vector<T, Allocator> &data){
+            return writable(data.data(), data.size());
+        }
+
+        ///
+        /// Creates a view of a string's bytes that scripts can write to, the string must not be resized until the run ended
+        /// \param data the string
+        /// \throw ScriptError if no run is executed by the calling thread
+        /// \return a writable memoryview of the bytes with format "B"
+        ///
+        static boost::python::object writable(std::string &data);
+
+        ///
+        /// Creates a one dimensional view of an array
+        /// \param data the first element
+        /// \param size the number of elements
+        /// \param item_size the size of an element in bytes
+        /// \param format the struct module format code of an element, a string that lives as long as the process
+        /// \param writable false if scripts can only read the elements
+        /// \throw ScriptError if no run is executed by the calling thread
+        /// \return the memoryview
+        ///
+        static boost::python::object create(void *data, std::size_t size, std::size_t item_size, const char *format, bool writable);
+
+        ///
+        /// The views created by the calling thread during a run's execution, used by the run to release them
+        /// This type should not be used by the library's user and is only for internal housekeeping
+        ///
+        class Scope {
+        public:
+
+            ///
+            /// Starts collecting the views created by the calling thread, scopes can be nested
+            ///
+            Scope();
+
+            ///
+            /// Releases the views, the memory they reference can be freed afterwards
+            /// Should be called while the GIL is held, after the run's local dictionary was destroyed
+            /// \param id the ID of the source of the run
+            /// \throw BufferExportedError if a view was kept by the script, e.g. as a slice or an array using the view's memory
+            ///
+            void release(const Source::Id &id);
+
+            ///
+            /// Releases the views if release() was not called, e.g. because the run failed
+            ///
+            ~Scope();
+
+        private:
+            struct View {
+                PyObject *view;
+                PyObject *exporter;
+            };
+
+            bool release_views();
+
+            Scope *previous_;
+            std::vector<View> views_;
+
+            friend class BufferView;
+
+            Scope(const Scope &) = delete;
+            Scope &operator=(const Scope &) = delete;
+        };
+
+    private:
+        BufferView() = delete;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_BUFFER_H */
+
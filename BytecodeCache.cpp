@@ -0,0 +1,145 @@
+#include "BytecodeCache.h"
+
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+
+#include <marshal.h>
+
+#if TARGET_OS_UNIX_LIKE
+#include <unistd.h>
+#elif TARGET_OS_WINDOWS
+#include <process.h>
+#endif
+
+using namespace PythonCppUtility;
+using namespace std;
+
+namespace{
+
+    ///
+    /// FNV-1a, used because the hash has to be stable between processes and builds
+    ///
+    uint64_t hash_string(const char *value, size_t size){
+        uint64_t hash = 14695981039346656037ULL;
+        for(size_t i = 0; i < size; ++i){
+            hash ^= static_cast<unsigned char>(value[i]);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    ///
+    /// \return the ID of the calling process, thread IDs alone repeat between processes sharing a cache directory
+    ///
+    unsigned long process_id(){
+#if TARGET_OS_UNIX_LIKE
+        return static_cast<unsigned long>(getpid());
+#elif TARGET_OS_WINDOWS
+        return static_cast<unsigned long>(_getpid());
+#else
+        return 0;
+#endif
+    }
+
+    uint64_t hash_string(const string &value){
+        return hash_string(value.data(), value.size());
+    }
+
+    uint64_t hash_code(boost::python::str code){
+        Py_ssize_t size = 0;
+        const char *text = PyUnicode_AsUTF8AndSize(code.ptr(), &size);
+        if(!text){
+            boost::python::throw_error_already_set();
+        }
+        return hash_string(text, static_cast<size_t>(size));
+    }
+
+    void write_integer(string &output, uint64_t value){
+        for(int i = 0; i < 8; ++i){
+            output.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+        }
+    }
+
+    ///
+    /// An entry consists of python's magic number, the source code's hash, the source path and the marshalled code object
+    ///
+    string entry_header(const string &path, boost::python::str code){
+        string header;
+        write_integer(header, static_cast<uint64_t>(PyImport_GetMagicNumber()));
+        write_integer(header, hash_code(code));
+        write_integer(header, path.size());
+        header.append(path);
+        return header;
+    }
+}
+
+BytecodeCache::BytecodeCache(const string &directory) : directory_(directory), hits_(), misses_(){}
+
+string BytecodeCache::entry_path(const string &path) const{
+    ostringstream result;
+    result << directory_ << '/' << hex << hash_string(path) << ".pycache";
+    return result.str();
+}
+
+boost::python::object BytecodeCache::load(const string &path, boost::python::str code){
+    using namespace boost::python;
+    ifstream input{entry_path(path).c_str(), ios::binary};
+    if(input){
+        string entry{istreambuf_iterator<char>{input}, {}};
+        string header = entry_header(path, code);
+        if(entry.size() > header.size() && entry.compare(0, header.size(), header) == 0){
+            PyObject *compiled = PyMarshal_ReadObjectFromString(entry.data() + header.size(), entry.size() - header.size());
+            if(compiled && PyCode_Check(compiled)){
+                ++hits_;
+                return object{handle<>{compiled}};
+            }
+            Py_XDECREF(compiled);
+            PyErr_Clear();
+        }
+    }
+    ++misses_;
+    return object{};
+}
+
+void BytecodeCache::store(const string &path, boost::python::str code, boost::python::object compiled){
+    PyObject *data = PyMarshal_WriteObjectToString(compiled.ptr(), Py_MARSHAL_VERSION);
+    if(!data){
+        PyErr_Clear();
+        return;
+    }
+    string entry = entry_header(path, code);
+    entry.append(PyBytes_AS_STRING(data), PyBytes_GET_SIZE(data));
+    Py_DECREF(data);
+
+    // Write to a temporary file first so concurrent readers never see a partial entry
+    string target = entry_path(path);
+    ostringstream temporary;
+    temporary << target << '.' << hex << process_id() << '.' << hash<thread::id>{}(this_thread::get_id());
+    {
+        ofstream output{temporary.str().c_str(), ios::binary | ios::trunc};
+        if(!output.write(entry.data(), entry.size())){
+            output.close();
+            remove(temporary.str().c_str());
+            return;
+        }
+    }
+    if(rename(temporary.str().c_str(), target.c_str()) != 0){
+        remove(temporary.str().c_str());
+    }
+}
+
+const string &BytecodeCache::directory() const{
+    return directory_;
+}
+
+size_t BytecodeCache::hits() const{
+    return hits_.load();
+}
+
+size_t BytecodeCache::misses() const{
+    return misses_.load();
+}
@@ -0,0 +1,82 @@
+///
+/// Contains a persistent cache for compiled python code
+///
+
+#ifndef PYTHON_CPP_UTILITY_BYTECODE_CACHE_H
+#define	PYTHON_CPP_UTILITY_BYTECODE_CACHE_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+
+#include <boost/python.hpp>
+
+namespace PythonCppUtility {
+
+    ///
+    /// An on-disk cache for compiled code objects
+    /// Code objects are marshalled to a file in the cache directory, keyed by the path of the source file, a hash of the source code and python's magic number
+    /// A cache entry that does not match any of these is ignored and will be overwritten the next time the code is compiled
+    ///
+    class BytecodeCache {
+    public:
+
+        ///
+        /// Creates a new bytecode cache
+        /// \param directory the system dependent path of an existing directory where the compiled code will be stored
+        ///
+        BytecodeCache(const std::string &directory);
+
+        ///
+        /// Loads a code object from the cache
+        /// Should only be called while the GIL is held
+        /// \param path the system dependent path of the source file
+        /// \param code the current python source code of the file
+        /// \return the cached code object or None if no matching entry was found
+        ///
+        boost::python::object load(const std::string &path, boost::python::str code);
+
+        ///
+        /// Stores a code object in the cache, silently ignoring any failure to write the cache entry
+        /// Should only be called while the GIL is held
+        /// \param path the system dependent path of the source file
+        /// \param code the python source code the code object was compiled from
+        /// \param compiled the compiled code object
+        ///
+        void store(const std::string &path, boost::python::str code, boost::python::object compiled);
+
+        ///
+        /// \return the system dependent path of the cache directory
+        ///
+        const std::string &directory() const;
+
+        ///
+        /// \return the number of code objects that were loaded from the cache
+        ///
+        std::size_t hits() const;
+
+        ///
+        /// \return the number of lookups that did not find a matching cache entry
+        ///
+        std::size_t misses() const;
+
+    private:
+        std::string directory_;
+        std::atomic<std::size_t> hits_;
+        std::atomic<std::size_t> misses_;
+
+        std::string entry_path(const std::string &path) const;
+
+        BytecodeCache(const BytecodeCache &) = delete;
+        BytecodeCache &operator=(const BytecodeCache &) = delete;
+    };
+
+    ///
+    /// A reference counted pointer to a bytecode cache, allowing multiple sources to share the same cache
+    ///
+    using BytecodeCacheRef = std::shared_ptr<BytecodeCache>;
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_BYTECODE_CACHE_H */
+
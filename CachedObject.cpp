@@ -0,0 +1,169 @@
+#include "CachedObject.h"
+
+#include <mutex>
+
+using namespace PythonCppUtility;
+using namespace std;
+
+namespace{
+
+    ///
+    /// Bookkeeping for a sub-interpreter, slot 0 is used for the main interpreter
+    ///
+    struct Slot{
+        size_t generation;
+        vector<PyObject *> pending;
+    };
+
+    atomic<size_t> next_generation{1};
+
+    atomic<size_t> main_generation{next_generation++};
+
+    atomic<size_t> pending_count{0};
+
+    mutex slots_mutex;
+
+    vector<Slot> slots(1, Slot{0, vector<PyObject *>{}});
+
+    thread_local size_t current_slot = 0;
+
+    thread_local size_t current_slot_generation = 0;
+
+    size_t current_generation(){
+        return current_slot == 0 ? main_generation.load() : current_slot_generation;
+    }
+
+    void release_later(size_t slot, size_t generation, PyObject *object){
+        lock_guard<mutex> lock{slots_mutex};
+        size_t slot_generation = slot == 0 ? main_generation.load() : slots[slot].generation;
+        if(slot_generation == generation){
+            slots[slot].pending.push_back(object);
+            ++pending_count;
+        }
+    }
+
+    void release_all(vector<PyObject *> &objects){
+        for(PyObject *object : objects){
+            Py_DECREF(object);
+        }
+        objects.clear();
+    }
+}
+
+CachedObject::CachedObject() : entries_(){}
+
+const CachedObject::Entry *CachedObject::current_entry() const{
+    if(current_slot < entries_.size()){
+        const Entry &entry = entries_[current_slot];
+        if(entry.object && entry.generation == current_generation()){
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool CachedObject::empty(size_t version) const{
+    const Entry *entry = current_entry();
+    return !entry || entry->version != version;
+}
+
+boost::python::object CachedObject::get(size_t version) const{
+    using namespace boost::python;
+    if(empty(version)){
+        return object{};
+    }else{
+        return object{handle<>{borrowed(current_entry()->object)}};
+    }
+}
+
+void CachedObject::set(boost::python::object object, size_t version){
+    if(entries_.size() <= current_slot){
+        entries_.resize(current_slot + 1, Entry{nullptr, 0, 0});
+    }
+    const Entry *old_entry = current_entry();
+    PyObject *old_object = old_entry ? old_entry->object : nullptr;
+    entries_[current_slot] = Entry{boost::python::incref(object.ptr()), current_generation(), version};
+    Py_XDECREF(old_object);
+}
+
+void CachedObject::reset(){
+    const Entry *old_entry = current_entry();
+    if(old_entry){
+        PyObject *old_object = old_entry->object;
+        entries_[current_slot].object = nullptr;
+        Py_DECREF(old_object);
+    }
+}
+
+void CachedObject::discard_all(){
+    vector<PyObject *> pending;
+    {
+        lock_guard<mutex> lock{slots_mutex};
+        pending_count -= slots[0].pending.size();
+        pending.swap(slots[0].pending);
+        main_generation = next_generation++;
+    }
+    release_all(pending);
+}
+
+size_t CachedObject::open_interpreter(){
+    lock_guard<mutex> lock{slots_mutex};
+    size_t slot = 1;
+    while(slot < slots.size() && slots[slot].generation != 0){
+        ++slot;
+    }
+    if(slot == slots.size()){
+        slots.push_back(Slot{0, vector<PyObject *>{}});
+    }
+    slots[slot].generation = next_generation++;
+    return slot;
+}
+
+void CachedObject::close_interpreter(size_t slot){
+    vector<PyObject *> pending;
+    {
+        lock_guard<mutex> lock{slots_mutex};
+        pending_count -= slots[slot].pending.size();
+        pending.swap(slots[slot].pending);
+        slots[slot].generation = 0;
+    }
+    release_all(pending);
+}
+
+void CachedObject::enter_interpreter(size_t slot){
+    lock_guard<mutex> lock{slots_mutex};
+    current_slot = slot;
+    current_slot_generation = slot == 0 ? 0 : slots[slot].generation;
+}
+
+void CachedObject::release_pending(){
+    if(pending_count.load() == 0){
+        return;
+    }
+    vector<PyObject *> pending;
+    {
+        lock_guard<mutex> lock{slots_mutex};
+        pending_count -= slots[current_slot].pending.size();
+        pending.swap(slots[current_slot].pending);
+    }
+    release_all(pending);
+}
+
+CachedObject::~CachedObject(){
+    for(size_t slot = 0; slot < entries_.size(); ++slot){
+        const Entry &entry = entries_[slot];
+        if(!entry.object){
+            continue;
+        }
+        if(slot == 0 && current_slot == 0){
+            if(entry.generation == main_generation.load() && Py_IsInitialized()){
+                PyGILState_STATE state = PyGILState_Ensure();
+                Py_DECREF(entry.object);
+                PyGILState_Release(state);
+            }
+        }else{
+            // The GIL of another interpreter can not be acquired safely from here
+            release_later(slot, entry.generation, entry.object);
+        }
+    }
+}
@@ -0,0 +1,115 @@
+///
+/// Contains a type to keep python objects alive outside of script runs
+///
+
+#ifndef PYTHON_CPP_UTILITY_CACHED_OBJECT_H
+#define	PYTHON_CPP_UTILITY_CACHED_OBJECT_H
+
+#include <atomic>
+#include <vector>
+
+#include <boost/python.hpp>
+
+namespace PythonCppUtility {
+
+    ///
+    /// A reference to a python object that outlives the script run that created it
+    /// Unlike boost::python::object, this type can be destroyed without holding the GIL and even after the interpreter was finalized
+    /// Objects created by a previous interpreter are never touched again, they are simply considered to be empty
+    /// When sub-interpreters are used, a separate object is cached for each interpreter since python objects can not be shared between interpreters
+    /// The cached object can be tagged with a version to detect stale objects
+    /// This type is not thread safe, concurrent access should be synchronized by the owner
+    ///
+    class CachedObject {
+    public:
+
+        ///
+        /// Creates an empty cached object
+        ///
+        CachedObject();
+
+        ///
+        /// \param version the expected version of the cached object
+        /// \return true if no object with this version was cached for the current interpreter, false otherwise
+        ///
+        bool empty(std::size_t version = 0) const;
+
+        ///
+        /// Should only be called while the GIL is held
+        /// \param version the expected version of the cached object
+        /// \return the object cached for the current interpreter or None if the cache is empty or the cached object has a different version
+        ///
+        boost::python::object get(std::size_t version = 0) const;
+
+        ///
+        /// Replaces the object cached for the current interpreter
+        /// Should only be called while the GIL is held
+        /// \param object the new object
+        /// \param version the version of the new object
+        ///
+        void set(boost::python::object object, std::size_t version = 0);
+
+        ///
+        /// Empties the cache for the current interpreter
+        /// Should only be called while the GIL is held
+        ///
+        void reset();
+
+        ///
+        /// Tells all cached objects that the main interpreter is about to be finalized
+        /// Should be called by the script system singleton with the GIL held, before the interpreter is finalized
+        ///
+        static void discard_all();
+
+        ///
+        /// Registers a new sub-interpreter, so objects can be cached for it
+        /// Should be called while the new interpreter's GIL is held
+        /// \return the slot of the new interpreter
+        ///
+        static std::size_t open_interpreter();
+
+        ///
+        /// Releases all objects queued for release in the interpreter and discards all objects cached for it
+        /// Should be called while the interpreter's GIL is held, before the interpreter is ended
+        /// \param slot the slot of the interpreter
+        ///
+        static void close_interpreter(std::size_t slot);
+
+        ///
+        /// Binds the calling thread to an interpreter, all objects cached by this thread will belong to it
+        /// \param slot the slot of the interpreter, or 0 for the main interpreter
+        ///
+        static void enter_interpreter(std::size_t slot);
+
+        ///
+        /// Releases objects that were destroyed by other threads while they were cached for the calling thread's interpreter
+        /// Should be called while the GIL of the calling thread's interpreter is held
+        ///
+        static void release_pending();
+
+        ///
+        /// Releases the cached objects, acquiring the GIL if necessary
+        /// Objects belonging to sub-interpreters are queued until their interpreter's GIL is acquired
+        ///
+        ~CachedObject();
+
+    private:
+
+        struct Entry {
+            PyObject *object;
+            std::size_t generation;
+            std::size_t version;
+        };
+
+        std::vector<Entry> entries_;
+
+        const Entry *current_entry() const;
+
+        CachedObject(const CachedObject &) = delete;
+        CachedObject &operator=(const CachedObject &) = delete;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_CACHED_OBJECT_H */
+
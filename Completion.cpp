@@ -0,0 +1,71 @@
+#include "Completion.h"
+
+#include <cassert>
+
+using namespace PythonCppUtility;
+using namespace std;
+
+Completion::Completion() : state_(){}
+
+Completion::Completion(MemoryPoolRef pool) : state_(allocate_shared<State>(PoolAllocator<State>{pool})){
+    state_->done = false;
+    state_->pool = move(pool);
+}
+
+void Completion::complete(exception_ptr error){
+    assert(state_);
+    vector<function<void (exception_ptr)>> continuations;
+    {
+        lock_guard<mutex> lock{state_->mutex};
+        if(state_->done){
+            return;
+        }
+        state_->done = true;
+        state_->error = error;
+        continuations.swap(state_->continuations);
+    }
+    for(function<void (exception_ptr)> &continuation : continuations){
+        continuation(error);
+    }
+}
+
+Completion Completion::then(Handler handler, Executor executor){
+    assert(state_);
+    Completion next{state_->pool};
+    function<void (exception_ptr)> continuation = [handler, executor, next](exception_ptr error) mutable{
+        auto run_handler = [handler, next, error]() mutable{
+            exception_ptr handler_error;
+            try{
+                handler(error);
+            }catch(...){
+                handler_error = current_exception();
+            }
+            next.complete(handler_error);
+        };
+        if(executor){
+            executor(run_handler);
+        }else{
+            run_handler();
+        }
+    };
+    exception_ptr error;
+    {
+        lock_guard<mutex> lock{state_->mutex};
+        if(!state_->done){
+            state_->continuations.push_back(move(continuation));
+            return next;
+        }
+        error = state_->error;
+    }
+    continuation(error);
+    return next;
+}
+
+bool Completion::valid() const{
+    return static_cast<bool>(state_);
+}
+
+bool Completion::done() const{
+    lock_guard<mutex> lock{state_->mutex};
+    return state_->done;
+}
@@ -0,0 +1,91 @@
+///
+/// Contains a type to react to the completion of script runs without blocking a thread
+///
+
+#ifndef PYTHON_CPP_UTILITY_COMPLETION_H
+#define	PYTHON_CPP_UTILITY_COMPLETION_H
+
+#include "MemoryPool.h"
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace PythonCppUtility {
+
+    ///
+    /// The completion of an asynchronous operation, e.g. a script run, to which continuations can be attached
+    /// Copies of a completion refer to the same operation, only valid completions should be completed or continued
+    /// This type is thread safe
+    ///
+    class Completion {
+    public:
+
+        ///
+        /// The type of a continuation
+        /// \param error the error the operation failed with, or nullptr if it succeeded
+        ///
+        using Handler = std::function<void (std::exception_ptr error)>;
+
+        ///
+        /// The type of a function that runs a continuation, e.g. by posting it to a thread pool or event loop
+        /// \param task the continuation to run
+        ///
+        using Executor = std::function<void (std::function<void ()> task)>;
+
+        ///
+        /// Creates an empty completion that does not refer to any operation
+        ///
+        Completion();
+
+        ///
+        /// Creates a pending completion
+        /// \param pool the pool to allocate the shared state from, or an empty reference to use the heap
+        ///
+        explicit Completion(MemoryPoolRef pool);
+
+        ///
+        /// Completes the operation and runs the attached continuations in the calling thread, or passes them to their executors
+        /// Only the first call has an effect
+        /// \param error the error the operation failed with, or nullptr if it succeeded
+        ///
+        void complete(std::exception_ptr error);
+
+        ///
+        /// Attaches a continuation
+        /// If the operation is already completed, the continuation runs right away in the calling thread or is passed to the executor
+        /// \param handler the continuation, called with the error of the operation
+        /// \param executor the executor to run the continuation with, or an empty function to run it in the thread that completes the operation
+        /// \return the completion of the continuation, which fails with the exception thrown by the handler or succeeds if it returns normally
+        ///
+        Completion then(Handler handler, Executor executor = Executor{});
+
+        ///
+        /// \return true if the operation was completed, false otherwise
+        ///
+        bool done() const;
+
+        ///
+        /// \return true if the completion refers to an operation, false if it is empty
+        ///
+        bool valid() const;
+
+    private:
+
+        struct State {
+            std::mutex mutex;
+            bool done;
+            std::exception_ptr error;
+            std::vector<std::function<void (std::exception_ptr error)>> continuations;
+            MemoryPoolRef pool;
+        };
+
+        std::shared_ptr<State> state_;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_COMPLETION_H */
+
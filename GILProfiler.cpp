@@ -0,0 +1,128 @@
+#include "GILProfiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+using namespace PythonCppUtility;
+using namespace std;
+
+namespace{
+    struct SiteCounters {
+        LatencyHistogram wait;
+        LatencyHistogram hold;
+    };
+
+    struct ThreadCounters {
+        std::thread::id thread;
+        atomic<uint64_t> acquisitions;
+        atomic<uint64_t> wait;
+        atomic<uint64_t> hold;
+    };
+
+    ///
+    /// The counters of all call sites and threads, which are never freed so the counters of ended threads can still be reported
+    ///
+    struct Registry {
+        std::mutex mutex;
+        map<string, unique_ptr<SiteCounters>> sites;
+        vector<unique_ptr<ThreadCounters>> threads;
+    };
+
+    Registry &registry(){
+        static Registry *registry = new Registry{};
+        return *registry;
+    }
+
+    ///
+    /// The counters of the call sites the calling thread used, by the address of their name
+    ///
+    thread_local unordered_map<const char *, SiteCounters *> thread_sites;
+
+    thread_local ThreadCounters *thread_counters = nullptr;
+
+    uint64_t nanoseconds(chrono::steady_clock::duration duration){
+        int64_t count = chrono::duration_cast<chrono::nanoseconds>(duration).count();
+        return count > 0 ? static_cast<uint64_t>(count) : 0;
+    }
+
+    string format_duration(chrono::nanoseconds duration){
+        ostringstream stream;
+        stream << chrono::duration_cast<chrono::microseconds>(duration).count() << "us";
+        return stream.str();
+    }
+}
+
+bool GILProfiler::enabled(){
+#if PYTHON_CPP_UTILITY_GIL_PROFILER
+    return true;
+#else
+    return false;
+#endif
+}
+
+void GILProfiler::record(const char *site, chrono::steady_clock::duration wait, chrono::steady_clock::duration hold){
+    if(!thread_counters){
+        Registry &counters = registry();
+        lock_guard<mutex> lock{counters.mutex};
+        counters.threads.emplace_back(new ThreadCounters{this_thread::get_id(), {0}, {0}, {0}});
+        thread_counters = counters.threads.back().get();
+    }
+    SiteCounters *&site_counters = thread_sites[site];
+    if(!site_counters){
+        Registry &counters = registry();
+        lock_guard<mutex> lock{counters.mutex};
+        unique_ptr<SiteCounters> &found = counters.sites[site];
+        if(!found){
+            found.reset(new SiteCounters{});
+        }
+        site_counters = found.get();
+    }
+    site_counters->wait.record(wait);
+    site_counters->hold.record(hold);
+    thread_counters->acquisitions.fetch_add(1, memory_order_relaxed);
+    thread_counters->wait.fetch_add(nanoseconds(wait), memory_order_relaxed);
+    thread_counters->hold.fetch_add(nanoseconds(hold), memory_order_relaxed);
+}
+
+GILProfiler::Report GILProfiler::report(){
+    Report report;
+    Registry &counters = registry();
+    {
+        lock_guard<mutex> lock{counters.mutex};
+        for(const auto &site : counters.sites){
+            report.sites.push_back(SiteStats{site.first, site.second->wait.snapshot(), site.second->hold.snapshot()});
+        }
+        for(const unique_ptr<ThreadCounters> &thread : counters.threads){
+            report.threads.push_back(ThreadStats{thread->thread, thread->acquisitions.load(memory_order_relaxed), chrono::nanoseconds{static_cast<chrono::nanoseconds::rep>(thread->wait.load(memory_order_relaxed))}, chrono::nanoseconds{static_cast<chrono::nanoseconds::rep>(thread->hold.load(memory_order_relaxed))}});
+        }
+    }
+    sort(report.sites.begin(), report.sites.end(), [](const SiteStats &first, const SiteStats &second){
+        return first.hold.sum > second.hold.sum;
+    });
+    sort(report.threads.begin(), report.threads.end(), [](const ThreadStats &first, const ThreadStats &second){
+        return first.hold > second.hold;
+    });
+    return report;
+}
+
+string GILProfiler::Report::to_string(size_t top) const{
+    ostringstream stream;
+    stream << "call site: acquisitions, wait total/p50/p99/max, hold total/p50/p99/max\n";
+    for(size_t i = 0; i < sites.size() && i < top; ++i){
+        const SiteStats &site = sites[i];
+        stream << site.site << ": " << site.wait.count
+               << ", " << format_duration(site.wait.sum) << "/" << format_duration(site.wait.percentile(50)) << "/" << format_duration(site.wait.percentile(99)) << "/" << format_duration(site.wait.max)
+               << ", " << format_duration(site.hold.sum) << "/" << format_duration(site.hold.percentile(50)) << "/" << format_duration(site.hold.percentile(99)) << "/" << format_duration(site.hold.max) << "\n";
+    }
+    stream << "thread: acquisitions, wait total, hold total\n";
+    for(size_t i = 0; i < threads.size() && i < top; ++i){
+        const ThreadStats &thread = threads[i];
+        stream << thread.thread << ": " << thread.acquisitions << ", " << format_duration(thread.wait) << ", " << format_duration(thread.hold) << "\n";
+    }
+    return stream.str();
+}
@@ -0,0 +1,120 @@
+///
+/// Contains a profiler for the time threads spend waiting for and holding Python's interpreter lock
+/// The profiler only records if the library is built with PYTHON_CPP_UTILITY_GIL_PROFILER defined, see the PYTHON_SCRIPT_UTIL_GIL_PROFILER build option. Code including the headers does not need the definition
+///
+
+#ifndef PYTHON_CPP_UTILITY_GIL_PROFILER_H
+#define	PYTHON_CPP_UTILITY_GIL_PROFILER_H
+
+#include "Histogram.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PythonCppUtility {
+
+    ///
+    /// Collects the wait and hold times of all GILGuards of the process, per call site and per thread
+    /// Each thread records into it's own counters and into lock free histograms, only the first guard of a thread at a call site takes a lock
+    /// Nested guards are not recorded, their time is part of the outermost guard of the thread
+    /// This type is thread safe
+    ///
+    class GILProfiler {
+    public:
+
+        ///
+        /// \return true if the library was built with the profiler, false if GILGuard does not record anything
+        ///
+        static bool enabled();
+
+        ///
+        /// The times recorded for a call site
+        ///
+        struct SiteStats {
+            ///
+            /// The name of the call site passed to GILGuard
+            ///
+            std::string site;
+
+            ///
+            /// The time from requesting the GIL until it was acquired, the count of the histogram is the number of acquisitions
+            ///
+            LatencyHistogram::Snapshot wait;
+
+            ///
+            /// The time from acquiring the GIL until the guard released it, including periods in which the interpreter handed the GIL to other threads
+            ///
+            LatencyHistogram::Snapshot hold;
+        };
+
+        ///
+        /// The times recorded for a thread
+        ///
+        struct ThreadStats {
+            ///
+            /// The thread
+            ///
+            std::thread::id thread;
+
+            ///
+            /// The number of times the thread acquired the GIL
+            ///
+            std::uint64_t acquisitions;
+
+            ///
+            /// The total time the thread waited for the GIL
+            ///
+            std::chrono::nanoseconds wait;
+
+            ///
+            /// The total time the thread held the GIL
+            ///
+            std::chrono::nanoseconds hold;
+        };
+
+        ///
+        /// A snapshot of all recorded times
+        ///
+        struct Report {
+            ///
+            /// The call sites, the longest total hold time first
+            ///
+            std::vector<SiteStats> sites;
+
+            ///
+            /// The threads that acquired the GIL, including threads that ended, the longest total hold time first
+            ///
+            std::vector<ThreadStats> threads;
+
+            ///
+            /// Formats the totals and percentiles of the top holders as a human readable table
+            /// \param top the maximum number of call sites and threads to list
+            /// \return the table
+            ///
+            std::string to_string(std::size_t top = 10) const;
+        };
+
+        ///
+        /// Records the times of a guard, called by GILGuard when it releases the GIL
+        /// \param site the name of the guard's call site, a string that lives as long as the process
+        /// \param wait the time from requesting the GIL until it was acquired
+        /// \param hold the time from acquiring the GIL until it was released
+        ///
+        static void record(const char *site, std::chrono::steady_clock::duration wait, std::chrono::steady_clock::duration hold);
+
+        ///
+        /// \return a snapshot of the times recorded since the process started, empty if the profiler is disabled
+        ///
+        static Report report();
+
+    private:
+        GILProfiler() = delete;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_GIL_PROFILER_H */
+
@@ -0,0 +1,92 @@
+#include "Histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace PythonCppUtility;
+using namespace std;
+
+LatencyHistogram::LatencyHistogram() : count_(0), sum_(0), max_(0){
+    for(atomic<uint64_t> &bucket : buckets_){
+        bucket = 0;
+    }
+}
+
+unsigned LatencyHistogram::bucket_index(uint64_t nanoseconds){
+    if(nanoseconds < sub_bucket_count){
+        return static_cast<unsigned>(nanoseconds);
+    }
+    unsigned magnitude = 63;
+    while(!(nanoseconds >> magnitude)){
+        --magnitude;
+    }
+    if(magnitude > max_magnitude){
+        return bucket_count - 1;
+    }
+    unsigned sub_bucket = static_cast<unsigned>(nanoseconds >> (magnitude - sub_bucket_bits)) - sub_bucket_count;
+    return sub_bucket_count + (magnitude - sub_bucket_bits) * sub_bucket_count + sub_bucket;
+}
+
+uint64_t LatencyHistogram::bucket_limit(unsigned index){
+    // The lowest value of the next bucket
+    ++index;
+    if(index < sub_bucket_count){
+        return index;
+    }
+    unsigned magnitude = (index - sub_bucket_count) / sub_bucket_count + sub_bucket_bits;
+    uint64_t sub_bucket = (index - sub_bucket_count) % sub_bucket_count;
+    return (sub_bucket_count + sub_bucket) << (magnitude - sub_bucket_bits);
+}
+
+void LatencyHistogram::record(chrono::steady_clock::duration duration){
+    int64_t signed_nanoseconds = chrono::duration_cast<chrono::nanoseconds>(duration).count();
+    uint64_t nanoseconds = signed_nanoseconds > 0 ? static_cast<uint64_t>(signed_nanoseconds) : 0;
+    buckets_[bucket_index(nanoseconds)].fetch_add(1, memory_order_relaxed);
+    sum_.fetch_add(nanoseconds, memory_order_relaxed);
+    uint64_t max = max_.load(memory_order_relaxed);
+    while(nanoseconds > max && !max_.compare_exchange_weak(max, nanoseconds, memory_order_relaxed)){
+    }
+    count_.fetch_add(1, memory_order_release);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const{
+    Snapshot snapshot;
+    snapshot.count = count_.load(memory_order_acquire);
+    snapshot.sum = chrono::nanoseconds{static_cast<chrono::nanoseconds::rep>(sum_.load(memory_order_relaxed))};
+    snapshot.max = chrono::nanoseconds{static_cast<chrono::nanoseconds::rep>(max_.load(memory_order_relaxed))};
+    snapshot.buckets.reserve(bucket_count);
+    for(const atomic<uint64_t> &bucket : buckets_){
+        snapshot.buckets.push_back(bucket.load(memory_order_relaxed));
+    }
+    return snapshot;
+}
+
+chrono::nanoseconds LatencyHistogram::Snapshot::mean() const{
+    return count == 0 ? chrono::nanoseconds::zero() : sum / static_cast<chrono::nanoseconds::rep>(count);
+}
+
+chrono::nanoseconds LatencyHistogram::Snapshot::percentile(double percentile) const{
+    // The buckets may contain durations recorded after the count was read, so the total is counted again
+    uint64_t total = 0;
+    for(uint64_t bucket : buckets){
+        total += bucket;
+    }
+    if(total == 0){
+        return chrono::nanoseconds::zero();
+    }
+    uint64_t rank = static_cast<uint64_t>(ceil(std::min(std::max(percentile, 0.0), 100.0) / 100.0 * total));
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for(unsigned i = 0; i < buckets.size(); ++i){
+        seen += buckets[i];
+        if(seen >= rank){
+            chrono::nanoseconds limit{static_cast<chrono::nanoseconds::rep>(bucket_limit(i) - 1)};
+            return std::min(limit, this->max);
+        }
+    }
+    return this->max;
+}
+
+RunLatencySnapshot RunLatencySnapshot::of(const RunLatencies &latencies){
+    return RunLatencySnapshot{latencies.queued.snapshot(), latencies.gil_wait.snapshot(), latencies.before.snapshot(), latencies.execution.snapshot(), latencies.after.snapshot(), latencies.total.snapshot()};
+}
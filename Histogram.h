@@ -0,0 +1,159 @@
+///
+/// Contains lock free histograms to record the latencies of script runs
+///
+
+#ifndef PYTHON_CPP_UTILITY_HISTOGRAM_H
+#define	PYTHON_CPP_UTILITY_HISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace PythonCppUtility {
+
+    ///
+    /// A histogram of durations with logarithmic buckets that are each split into linear sub-buckets, like an HDR histogram
+    /// Durations are recorded in nanoseconds with a relative error of at most 12.5%, durations longer than about 18 minutes are counted in the last bucket
+    /// Recording is lock free and wait free except for updating the maximum, so any number of threads can record into the same histogram
+    /// This type is thread safe
+    ///
+    class LatencyHistogram {
+    public:
+
+        ///
+        /// A copy of a histogram's counters at a point in time
+        ///
+        struct Snapshot {
+            ///
+            /// The number of recorded durations
+            ///
+            std::uint64_t count;
+
+            ///
+            /// The sum of the recorded durations
+            ///
+            std::chrono::nanoseconds sum;
+
+            ///
+            /// The longest recorded duration
+            ///
+            std::chrono::nanoseconds max;
+
+            ///
+            /// The number of recorded durations per bucket
+            ///
+            std::vector<std::uint64_t> buckets;
+
+            ///
+            /// \return the mean of the recorded durations, or zero if none were recorded
+            ///
+            std::chrono::nanoseconds mean() const;
+
+            ///
+            /// Returns the duration that the given percentage of the recorded durations did not exceed, e.g. 99 for the 99th percentile
+            /// \param percentile the percentage, between 0 and 100
+            /// \return the highest duration of the bucket containing the percentile, at most the longest recorded duration. Zero if nothing was recorded
+            ///
+            std::chrono::nanoseconds percentile(double percentile) const;
+        };
+
+        ///
+        /// Creates an empty histogram
+        ///
+        LatencyHistogram();
+
+        ///
+        /// Records a duration
+        /// \param duration the duration, negative durations are recorded as zero
+        ///
+        void record(std::chrono::steady_clock::duration duration);
+
+        ///
+        /// Copies the counters, durations recorded concurrently may or may not be contained
+        /// \return the snapshot
+        ///
+        Snapshot snapshot() const;
+
+    private:
+
+        static const unsigned sub_bucket_bits = 3;
+
+        static const unsigned sub_bucket_count = 1 << sub_bucket_bits;
+
+        static const unsigned max_magnitude = 40;
+
+        static const unsigned bucket_count = sub_bucket_count + (max_magnitude - sub_bucket_bits + 1) * sub_bucket_count;
+
+        static unsigned bucket_index(std::uint64_t nanoseconds);
+
+        static std::uint64_t bucket_limit(unsigned index);
+
+        std::atomic<std::uint64_t> buckets_[bucket_count];
+        std::atomic<std::uint64_t> count_;
+        std::atomic<std::uint64_t> sum_;
+        std::atomic<std::uint64_t> max_;
+
+        LatencyHistogram(const LatencyHistogram &) = delete;
+        LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+    };
+
+    ///
+    /// The latency histograms of the runs of a source, split into the phases of a run
+    /// Only runs whose script and callbacks succeeded are recorded
+    ///
+    struct RunLatencies {
+        ///
+        /// From the submission of the run until a worker dequeued it
+        ///
+        LatencyHistogram queued;
+
+        ///
+        /// From the dequeuing of the run until the worker acquired the GIL
+        ///
+        LatencyHistogram gil_wait;
+
+        ///
+        /// The duration of the before callback
+        ///
+        LatencyHistogram before;
+
+        ///
+        /// The evaluation of the script, including it's compilation if the compiled code was not cached
+        ///
+        LatencyHistogram execution;
+
+        ///
+        /// The duration of the after callback
+        ///
+        LatencyHistogram after;
+
+        ///
+        /// From the submission of the run until the after callback returned
+        ///
+        LatencyHistogram total;
+    };
+
+    ///
+    /// A copy of the latency histograms of the runs of a source
+    ///
+    struct RunLatencySnapshot {
+        LatencyHistogram::Snapshot queued;
+        LatencyHistogram::Snapshot gil_wait;
+        LatencyHistogram::Snapshot before;
+        LatencyHistogram::Snapshot execution;
+        LatencyHistogram::Snapshot after;
+        LatencyHistogram::Snapshot total;
+
+        ///
+        /// Copies the histograms
+        /// \param latencies the histograms to copy
+        /// \return the snapshot
+        ///
+        static RunLatencySnapshot of(const RunLatencies &latencies);
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_HISTOGRAM_H */
+
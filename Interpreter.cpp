@@ -0,0 +1,103 @@
+#include "Interpreter.h"
+#include "CachedObject.h"
+
+using namespace PythonCppUtility;
+using namespace std;
+
+thread_local PyThreadState *MainInterpreterThread::thread_state_ = nullptr;
+
+thread_local PyGILState_STATE MainInterpreterThread::gil_state_ = PyGILState_UNLOCKED;
+
+void MainInterpreterThread::attach(){
+    // The GIL state API keeps the thread state alive as long as the outermost PyGILState_Ensure was not released
+    gil_state_ = PyGILState_Ensure();
+    thread_state_ = PyEval_SaveThread();
+}
+
+void MainInterpreterThread::detach(){
+    PyEval_RestoreThread(thread_state_);
+    thread_state_ = nullptr;
+    PyGILState_Release(gil_state_);
+}
+
+PyThreadState *MainInterpreterThread::thread_state(){
+    return thread_state_;
+}
+
+thread_local PyThreadState *SubInterpreter::thread_state_ = nullptr;
+
+SubInterpreter::SubInterpreter(const ModuleManager &modules, bool own_gil) : main_state_(PyThreadState_Get()), creator_state_(), slot_(), own_gil_(){
+#if PY_VERSION_HEX >= 0x030C0000
+    if(own_gil){
+        // Python would only refuse a single phase module when it is imported, with an error that does not name the module
+        modules.check_multi_interpreter_safe();
+        PyInterpreterConfig config;
+        config.use_main_obmalloc = 0;
+        config.allow_fork = 0;
+        config.allow_exec = 0;
+        config.allow_threads = 1;
+        config.allow_daemon_threads = 0;
+        config.check_multi_interp_extensions = 1;
+        config.gil = PyInterpreterConfig_OWN_GIL;
+        PyStatus status = Py_NewInterpreterFromConfig(&creator_state_, &config);
+        if(PyStatus_Exception(status)){
+            creator_state_ = nullptr;
+        }
+        own_gil_ = true;
+    }else{
+        creator_state_ = Py_NewInterpreter();
+    }
+#else
+    (void)own_gil;
+    creator_state_ = Py_NewInterpreter();
+#endif
+    if(!creator_state_){
+        PyThreadState_Swap(main_state_);
+        throw InterpreterError{"unable to create sub-interpreter"};
+    }
+    slot_ = CachedObject::open_interpreter();
+    CachedObject::enter_interpreter(slot_);
+    try{
+        modules.initialize_modules();
+    }catch(...){
+        CachedObject::close_interpreter(slot_);
+        CachedObject::enter_interpreter(0);
+        Py_EndInterpreter(creator_state_);
+        PyThreadState_Swap(main_state_);
+        throw;
+    }
+    CachedObject::enter_interpreter(0);
+    // Swapping thread states also switches to the main interpreter's GIL if the sub-interpreter has its own
+    PyThreadState_Swap(main_state_);
+}
+
+void SubInterpreter::attach(){
+    thread_state_ = PyThreadState_New(creator_state_->interp);
+    CachedObject::enter_interpreter(slot_);
+}
+
+void SubInterpreter::detach(){
+    PyEval_RestoreThread(thread_state_);
+    CachedObject::release_pending();
+    PyThreadState_Clear(thread_state_);
+    PyThreadState_DeleteCurrent();
+    thread_state_ = nullptr;
+    CachedObject::enter_interpreter(0);
+}
+
+bool SubInterpreter::own_gil() const{
+    return own_gil_;
+}
+
+PyThreadState *SubInterpreter::thread_state(){
+    return thread_state_;
+}
+
+SubInterpreter::~SubInterpreter(){
+    PyThreadState_Swap(creator_state_);
+    CachedObject::enter_interpreter(slot_);
+    CachedObject::close_interpreter(slot_);
+    CachedObject::enter_interpreter(0);
+    Py_EndInterpreter(creator_state_);
+    PyThreadState_Swap(main_state_);
+}
@@ -0,0 +1,119 @@
+///
+/// Contains types to run scripts in python sub-interpreters
+///
+
+#ifndef PYTHON_CPP_UTILITY_INTERPRETER_H
+#define	PYTHON_CPP_UTILITY_INTERPRETER_H
+
+#include "ScriptError.h"
+#include "Module.h"
+
+#include <boost/python.hpp>
+
+namespace PythonCppUtility {
+
+    ///
+    /// An error that is thrown when a sub-interpreter could not be created
+    ///
+    class InterpreterError : public ScriptError {
+    public:
+        using ScriptError::ScriptError;
+    };
+
+    ///
+    /// A thread state of the main interpreter that a worker thread keeps while it runs, used by the script system unless each worker has it's own sub-interpreter
+    /// Without it, each GILGuard of the thread creates and destroys a thread state, with it GILGuard only restores and saves the thread state
+    ///
+    class MainInterpreterThread {
+    public:
+
+        ///
+        /// Creates a thread state for the calling thread that is kept until detach() is called
+        /// Should be called without holding the GIL
+        ///
+        static void attach();
+
+        ///
+        /// Destroys the calling thread's thread state
+        /// Should be called without holding the GIL
+        ///
+        static void detach();
+
+        ///
+        /// \return the thread state of the calling thread if it is attached to the main interpreter, nullptr otherwise
+        ///
+        static PyThreadState *thread_state();
+
+    private:
+        static thread_local PyThreadState *thread_state_;
+        static thread_local PyGILState_STATE gil_state_;
+
+        MainInterpreterThread() = delete;
+    };
+
+    ///
+    /// A python sub-interpreter, used by the script system to give each worker thread its own interpreter
+    /// If python is version 3.12 or later and the interpreter is created with it's own GIL, scripts in different sub-interpreters run in parallel
+    /// Otherwise all sub-interpreters share the main interpreter's GIL and their scripts are serialized
+    /// Python objects, including objects of embedded modules, can not be shared between sub-interpreters
+    /// Note that extension modules using single phase initialization (like those defined with boost python) can not be imported in sub-interpreters with their own GIL
+    ///
+    class SubInterpreter {
+    public:
+
+        ///
+        /// Creates a new sub-interpreter and imports all defined modules in it
+        /// Should be called while the main interpreter's GIL is held, the calling thread's thread state is restored before the constructor returns
+        /// \param modules the modules to initialize in the new interpreter
+        /// \param own_gil if set to true, the interpreter will have it's own GIL, this is ignored for python versions before 3.12
+        /// \throw InterpreterError if the sub-interpreter could not be created
+        /// \throw SingleInterpreterModuleError if the interpreter has it's own GIL and one of the modules is not multi interpreter safe
+        /// \throw ModuleImportError if one of the modules could not be imported
+        ///
+        SubInterpreter(const ModuleManager &modules, bool own_gil = false);
+
+        ///
+        /// Binds the calling thread to this interpreter by creating a thread state for it
+        /// After this call, all GILGuard objects created by this thread will lock this interpreter
+        /// Should be called without holding any GIL
+        ///
+        void attach();
+
+        ///
+        /// Unbinds the calling thread from this interpreter and destroys it's thread state
+        /// Should be called without holding any GIL
+        ///
+        void detach();
+
+        ///
+        /// \return true if the interpreter has it's own GIL, false if it shares the main interpreter's GIL
+        ///
+        bool own_gil() const;
+
+        ///
+        /// \return the thread state of the calling thread if it is attached to a sub-interpreter, nullptr otherwise
+        ///
+        static PyThreadState *thread_state();
+
+        ///
+        /// Ends the interpreter
+        /// Should be called from the thread that created the interpreter while the main interpreter's GIL is held and after all threads have detached
+        ///
+        ~SubInterpreter();
+
+    private:
+        PyThreadState *main_state_;
+        PyThreadState *creator_state_;
+        std::size_t slot_;
+        bool own_gil_;
+
+        static thread_local PyThreadState *thread_state_;
+
+        SubInterpreter(const SubInterpreter &) = delete;
+        SubInterpreter &operator=(const SubInterpreter &) = delete;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_INTERPRETER_H */
+
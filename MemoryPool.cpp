@@ -0,0 +1,55 @@
+#include "MemoryPool.h"
+
+#include <new>
+
+using namespace PythonCppUtility;
+using namespace std;
+
+MemoryPool::MemoryPool() : mutex_(), free_blocks_(), heap_allocations_(0){}
+
+void *MemoryPool::allocate(size_t size){
+    if(size == 0 || size > max_block_size){
+        ++heap_allocations_;
+        return ::operator new(size);
+    }
+    size_t size_class = (size - 1) / granularity;
+    {
+        lock_guard<mutex> lock{mutex_};
+        FreeBlock *block = free_blocks_[size_class];
+        if(block){
+            free_blocks_[size_class] = block->next;
+            return block;
+        }
+    }
+    ++heap_allocations_;
+    return ::operator new((size_class + 1) * granularity);
+}
+
+void MemoryPool::deallocate(void *block, size_t size){
+    if(!block){
+        return;
+    }
+    if(size == 0 || size > max_block_size){
+        ::operator delete(block);
+        return;
+    }
+    size_t size_class = (size - 1) / granularity;
+    FreeBlock *free_block = static_cast<FreeBlock *>(block);
+    lock_guard<mutex> lock{mutex_};
+    free_block->next = free_blocks_[size_class];
+    free_blocks_[size_class] = free_block;
+}
+
+size_t MemoryPool::heap_allocations() const{
+    return heap_allocations_;
+}
+
+MemoryPool::~MemoryPool(){
+    for(FreeBlock *block : free_blocks_){
+        while(block){
+            FreeBlock *next = block->next;
+            ::operator delete(block);
+            block = next;
+        }
+    }
+}
@@ -0,0 +1,150 @@
+///
+/// Contains a memory pool to recycle the small objects allocated for each script run
+///
+
+#ifndef PYTHON_CPP_UTILITY_MEMORY_POOL_H
+#define	PYTHON_CPP_UTILITY_MEMORY_POOL_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+
+namespace PythonCppUtility {
+
+    ///
+    /// A pool of small memory blocks, blocks that are deallocated are kept on a free list per size class and handed out again by the next allocation of the same size class
+    /// Once the pool has warmed up, a steady rate of allocations does not reach the heap anymore
+    /// Blocks larger than max_block_size are allocated from and returned to the heap directly
+    /// This type is thread safe
+    ///
+    class MemoryPool {
+    public:
+
+        ///
+        /// The size in bytes of the largest block kept on a free list
+        ///
+        static const std::size_t max_block_size = 256;
+
+        ///
+        /// Creates an empty pool
+        ///
+        MemoryPool();
+
+        ///
+        /// Allocates a block, aligned for any fundamental type
+        /// \param size the size of the block in bytes
+        /// \return the block
+        /// \throw std::bad_alloc if the heap is exhausted
+        ///
+        void *allocate(std::size_t size);
+
+        ///
+        /// Returns a block to the pool
+        /// \param block a block allocated by this pool
+        /// \param size the size the block was allocated with
+        ///
+        void deallocate(void *block, std::size_t size);
+
+        ///
+        /// \return the number of blocks the pool had to allocate from the heap since it was created
+        ///
+        std::size_t heap_allocations() const;
+
+        ///
+        /// Frees the blocks on the free lists
+        /// Blocks that are still in use are not freed
+        ///
+        ~MemoryPool();
+
+    private:
+
+        static const std::size_t granularity = 16;
+
+        static const std::size_t size_class_count = max_block_size / granularity;
+
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        std::mutex mutex_;
+        FreeBlock *free_blocks_[size_class_count];
+        std::atomic<std::size_t> heap_allocations_;
+
+        MemoryPool(const MemoryPool &) = delete;
+        MemoryPool &operator=(const MemoryPool &) = delete;
+    };
+
+    ///
+    /// A reference to a memory pool
+    ///
+    using MemoryPoolRef = std::shared_ptr<MemoryPool>;
+
+    ///
+    /// A standard allocator that allocates from a memory pool, or from the heap if it has none
+    /// Each allocator keeps it's pool alive, so containers and shared states can outlive the pool's owner
+    /// \tparam T the type of the allocated objects
+    ///
+    template<typename T> class PoolAllocator {
+    public:
+        using value_type = T;
+
+        ///
+        /// Creates an allocator
+        /// \param pool the pool to allocate from, or an empty reference to allocate from the heap
+        ///
+        PoolAllocator(MemoryPoolRef pool = MemoryPoolRef{}) : pool_(std::move(pool)){}
+
+        ///
+        /// Creates an allocator that allocates from the same pool as another allocator
+        /// \param allocator the other allocator
+        ///
+        template<typename U> PoolAllocator(const PoolAllocator<U> &allocator) : pool_(allocator.pool()){}
+
+        ///
+        /// \param count the number of objects
+        /// \return uninitialized memory for the objects
+        ///
+        T *allocate(std::size_t count){
+            if(pool_){
+                return static_cast<T *>(pool_->allocate(count * sizeof(T)));
+            }else{
+                return static_cast<T *>(::operator new(count * sizeof(T)));
+            }
+        }
+
+        ///
+        /// \param objects memory allocated by an allocator equal to this one
+        /// \param count the number of objects it was allocated for
+        ///
+        void deallocate(T *objects, std::size_t count){
+            if(pool_){
+                pool_->deallocate(objects, count * sizeof(T));
+            }else{
+                ::operator delete(objects);
+            }
+        }
+
+        ///
+        /// \return the pool the allocator allocates from
+        ///
+        const MemoryPoolRef &pool() const{
+            return pool_;
+        }
+
+    private:
+        MemoryPoolRef pool_;
+    };
+
+    template<typename T, typename U> bool operator==(const PoolAllocator<T> &first, const PoolAllocator<U> &second){
+        return first.pool() == second.pool();
+    }
+
+    template<typename T, typename U> bool operator!=(const PoolAllocator<T> &first, const PoolAllocator<U> &second){
+        return first.pool() != second.pool();
+    }
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_MEMORY_POOL_H */
+
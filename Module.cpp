@@ -1,11 +1,13 @@
 #include "Module.h"
 
 #include <utility>
+#include <set>
+#include <mutex>
 
 using namespace PythonCppUtility;
 using namespace std;
 
-ModuleDefinition::ModuleDefinition(const ModuleDefinition::Id &id_, ModuleDefinition::Initializer initializer_) : id(id_), initializer(initializer_){}
+ModuleDefinition::ModuleDefinition(const ModuleDefinition::Id &id_, ModuleDefinition::Initializer initializer_, bool multi_interpreter_safe_) : id(id_), initializer(initializer_), multi_interpreter_safe(multi_interpreter_safe_){}
 
 ModuleError::ModuleError(const ModuleDefinition::Id &id, const std::string &message) : ScriptError(message), id_(id){}
 
@@ -17,6 +19,10 @@ DuplicateModuleError::DuplicateModuleError(const ModuleDefinition::Id &id) : Mod
 
 NoSuchModuleError::NoSuchModuleError(const ModuleDefinition::Id &id) : ModuleError(id, string{"no such module: "}+id){}
 
+ModuleImportError::ModuleImportError(const ModuleDefinition::Id &id) : ModuleError(id, string{"unable to import module: "}+id){}
+
+SingleInterpreterModuleError::SingleInterpreterModuleError(const ModuleDefinition::Id &id) : ModuleError(id, string{"module can not be imported in a sub-interpreter with it's own GIL: "}+id){}
+
 ModuleManager::ModuleManager() : definitions_(){}
 
 bool ModuleManager::has_module(const ModuleDefinition::Id &id) const{
@@ -32,13 +38,13 @@ void ModuleManager::add_module(const ModuleDefinition& definition){
     definitions_.insert(make_pair(definition.id, new ModuleDefinition{definition}));
 }
 
-void ModuleManager::add_module(const ModuleDefinition::Id &id, ModuleDefinition::Initializer initializer){
+void ModuleManager::add_module(const ModuleDefinition::Id &id, ModuleDefinition::Initializer initializer, bool multi_interpreter_safe){
     assert(!id.empty());
     assert(initializer != nullptr);
     if(has_module(id)){
         throw DuplicateModuleError{id};
     }
-    definitions_.insert(make_pair(id, new ModuleDefinition{id, initializer}));
+    definitions_.insert(make_pair(id, new ModuleDefinition{id, initializer, multi_interpreter_safe}));
 }
 
 void ModuleManager::remove_module(const ModuleDefinition::Id &id){
@@ -49,9 +55,42 @@ void ModuleManager::remove_module(const ModuleDefinition::Id &id){
     definitions_.erase(found);
 }
 
+namespace{
+    ///
+    /// The names of all modules appended to python's table of builtin modules
+    /// Python keeps pointers to the names for the lifetime of the process, so they can not be owned by a module manager
+    ///
+    set<ModuleDefinition::Id> appended_module_names;
+
+    mutex appended_module_names_mutex;
+}
+
 void ModuleManager::import_modules() const{
-    for(auto i : definitions_){
-        PyImport_AppendInittab(i.first.c_str(), i.second->initializer);
+    lock_guard<mutex> lock{appended_module_names_mutex};
+    for(auto &i : definitions_){
+        auto appended = appended_module_names.insert(i.first);
+        if(appended.second){
+            PyImport_AppendInittab(appended.first->c_str(), i.second->initializer);
+        }
+    }
+}
+
+void ModuleManager::initialize_modules() const{
+    for(auto &i : definitions_){
+        PyObject *module = PyImport_ImportModule(i.first.c_str());
+        if(!module){
+            PyErr_Print();
+            throw ModuleImportError{i.first};
+        }
+        Py_DECREF(module);
+    }
+}
+
+void ModuleManager::check_multi_interpreter_safe() const{
+    for(auto &i : definitions_){
+        if(!i.second->multi_interpreter_safe){
+            throw SingleInterpreterModuleError{i.first};
+        }
     }
 }
 
@@ -37,12 +37,19 @@ namespace PythonCppUtility {
         ///
         Initializer initializer;
 
+        ///
+        /// Whether the module can be imported in sub-interpreters with their own GIL
+        /// Only true for modules using multi phase initialization that declare support for a per interpreter GIL, modules defined with boost python are not
+        ///
+        bool multi_interpreter_safe;
+
         ///
         /// Creates a new module definition
         /// \param id_ the module's unique id
         /// \param initializer_ the module's initializer function
+        /// \param multi_interpreter_safe_ whether the module can be imported in sub-interpreters with their own GIL
         ///
-        ModuleDefinition(const Id &id_, Initializer initializer_);
+        ModuleDefinition(const Id &id_, Initializer initializer_, bool multi_interpreter_safe_ = false);
     };
 
     ///
@@ -90,6 +97,30 @@ namespace PythonCppUtility {
         NoSuchModuleError(const ModuleDefinition::Id &id);
     };
 
+    ///
+    /// An error that is thrown when a defined module could not be imported in an interpreter
+    ///
+    class ModuleImportError : public ModuleError {
+    public:
+        ///
+        /// Creates a new error
+        /// \param id the module's id
+        ///
+        ModuleImportError(const ModuleDefinition::Id &id);
+    };
+
+    ///
+    /// An error that is thrown when a module that is not multi interpreter safe would be imported in a sub-interpreter with it's own GIL
+    ///
+    class SingleInterpreterModuleError : public ModuleError {
+    public:
+        ///
+        /// Creates a new error
+        /// \param id the module's id
+        ///
+        SingleInterpreterModuleError(const ModuleDefinition::Id &id);
+    };
+
     ///
     /// This type keeps track of registered modules
     ///
@@ -132,9 +163,10 @@ namespace PythonCppUtility {
         /// Adds a module definition
         /// \param id the module's id
         /// \param initializer the module's initializer
+        /// \param multi_interpreter_safe whether the module can be imported in sub-interpreters with their own GIL, see ModuleDefinition::multi_interpreter_safe
         /// \throw DuplicateModuleError if a module with the definition's id was already defined
         ///
-        void add_module(const ModuleDefinition::Id &id, ModuleDefinition::Initializer initializer);
+        void add_module(const ModuleDefinition::Id &id, ModuleDefinition::Initializer initializer, bool multi_interpreter_safe = false);
 
         ///
         /// Removes a module
@@ -146,9 +178,23 @@ namespace PythonCppUtility {
         ///
         /// Adds all defined modules to the current embedded python interpreter
         /// Should be called by the script system singleton before it is started
+        /// Python's table of builtin modules can only grow: a module that was already added by a previous call keeps it's first initializer
         ///
         void import_modules() const;
 
+        ///
+        /// Imports all defined modules in the current interpreter
+        /// Should be called while the GIL is held, e.g. by the script system to initialize the modules in each sub-interpreter
+        /// \throw ModuleImportError if a module could not be imported
+        ///
+        void initialize_modules() const;
+
+        ///
+        /// Checks whether all defined modules can be imported in sub-interpreters with their own GIL
+        /// \throw SingleInterpreterModuleError if a module is not multi interpreter safe
+        ///
+        void check_multi_interpreter_safe() const;
+
         ///
         /// Destroys this module manager
         /// Does tot unregister the modules from the python interpreter, nor does it delete or modify the module's initializer function
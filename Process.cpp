@@ -0,0 +1,422 @@
+#include "Process.h"
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+
+#if TARGET_OS_UNIX_LIKE
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#endif
+
+using namespace PythonCppUtility;
+using namespace std;
+
+RemoteScriptError::RemoteScriptError(const Source::Id &id, const string &traceback) : SourceError(id, string{"script failed in worker process: "}+id+string{"\n"}+traceback){}
+
+const chrono::milliseconds WorkerProcess::stop_timeout{1000};
+
+thread_local WorkerProcess *WorkerProcess::current_ = nullptr;
+
+void WorkerProcess::attach(){
+    current_ = this;
+}
+
+void WorkerProcess::detach(){
+    current_ = nullptr;
+}
+
+int WorkerProcess::process_id() const{
+    return process_id_;
+}
+
+WorkerProcess *WorkerProcess::current(){
+    return current_;
+}
+
+#if TARGET_OS_UNIX_LIKE
+
+///
+/// A single producer, single consumer ring buffer living in memory shared between the two processes
+/// The positions count all bytes ever written and read, the buffer data directly follows this header
+///
+struct WorkerProcess::Channel{
+    pthread_mutex_t mutex;
+    pthread_cond_t readable;
+    pthread_cond_t writable;
+    size_t capacity;
+    size_t read_position;
+    size_t write_position;
+
+    char *data(){
+        return reinterpret_cast<char *>(this + 1);
+    }
+};
+
+namespace{
+
+    enum class RequestType : char{
+        RUN = 0, STOP = 1
+    };
+
+    enum class ResponseStatus : char{
+        SUCCESS = 0, SCRIPT_ERROR = 1, NO_SUCH_SOURCE = 2
+    };
+
+    const long poll_interval_nanoseconds = 100000000L;
+
+    ///
+    /// Releases the GIL using the RAII pattern
+    ///
+    class GILRelease{
+    public:
+        GILRelease() : state_(PyEval_SaveThread()){}
+
+        ~GILRelease(){
+            PyEval_RestoreThread(state_);
+        }
+    private:
+        PyThreadState *state_;
+    };
+
+    void lock(pthread_mutex_t &mutex){
+        // The other process may have died while holding the lock
+        if(pthread_mutex_lock(&mutex) == EOWNERDEAD){
+            pthread_mutex_consistent(&mutex);
+        }
+    }
+
+    ///
+    /// Waits on the condition for a limited time so the caller can check whether the other process is still alive
+    ///
+    void timed_wait(pthread_cond_t &condition, pthread_mutex_t &mutex){
+        timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += poll_interval_nanoseconds;
+        if(deadline.tv_nsec >= 1000000000L){
+            deadline.tv_nsec -= 1000000000L;
+            ++deadline.tv_sec;
+        }
+        if(pthread_cond_timedwait(&condition, &mutex, &deadline) == EOWNERDEAD){
+            pthread_mutex_consistent(&mutex);
+        }
+    }
+
+    void append_integer(string &output, uint64_t value){
+        output.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void append_string(string &output, const char *data, size_t size){
+        append_integer(output, size);
+        output.append(data, size);
+    }
+
+    string parse_string(const string &input, size_t &offset){
+        uint64_t size = 0;
+        if(input.size() < offset + sizeof(size)){
+            throw WorkerProcessError{"malformed message from worker process"};
+        }
+        memcpy(&size, input.data() + offset, sizeof(size));
+        offset += sizeof(size);
+        if(input.size() < offset + size){
+            throw WorkerProcessError{"malformed message from worker process"};
+        }
+        string result = input.substr(offset, size);
+        offset += size;
+        return result;
+    }
+
+    boost::python::object to_bytes(const string &data){
+        using namespace boost::python;
+        return object{handle<>{PyBytes_FromStringAndSize(data.data(), static_cast<Py_ssize_t>(data.size()))}};
+    }
+
+    void append_bytes(string &output, boost::python::object bytes){
+        char *data = nullptr;
+        Py_ssize_t size = 0;
+        if(PyBytes_AsStringAndSize(bytes.ptr(), &data, &size) != 0){
+            boost::python::throw_error_already_set();
+        }
+        append_string(output, data, static_cast<size_t>(size));
+    }
+
+    ///
+    /// Pickles the local dictionary, leaving out all values that can not be pickled, like modules
+    ///
+    boost::python::object pickle_locals(boost::python::object pickle, boost::python::object locals){
+        using namespace boost::python;
+        object dumps = pickle.attr("dumps");
+        object protocol = pickle.attr("HIGHEST_PROTOCOL");
+        try{
+            return dumps(locals, protocol);
+        }catch(error_already_set &e){
+            PyErr_Clear();
+        }
+        dict picklable;
+        list items{locals.attr("items")()};
+        for(ssize_t i = 0; i < len(items); ++i){
+            object key = items[i][0];
+            object value = items[i][1];
+            try{
+                dumps(value, protocol);
+                picklable[key] = value;
+            }catch(error_already_set &e){
+                PyErr_Clear();
+            }
+        }
+        return dumps(picklable, protocol);
+    }
+
+    string format_python_error(){
+        using namespace boost::python;
+        PyObject *type = nullptr;
+        PyObject *value = nullptr;
+        PyObject *traceback = nullptr;
+        PyErr_Fetch(&type, &value, &traceback);
+        PyErr_NormalizeException(&type, &value, &traceback);
+        if(!type){
+            return string{"unknown python error"};
+        }
+        try{
+            object type_object{handle<>{type}};
+            object value_object{handle<>{allow_null(value)}};
+            object traceback_object{handle<>{allow_null(traceback)}};
+            object lines = import("traceback").attr("format_exception")(type_object, value_object, traceback_object);
+            return extract<string>(str{""}.join(lines));
+        }catch(error_already_set &e){
+            PyErr_Clear();
+            return string{"unknown python error"};
+        }
+    }
+}
+
+WorkerProcess::WorkerProcess(const SourceManager &sources, size_t buffer_size) : sources_(sources), requests_(), responses_(), mapped_size_(), process_id_(), parent_process_id_(getpid()){
+    // Keep the second channel aligned
+    size_t channel_size = (sizeof(Channel) + buffer_size + 63) / 64 * 64;
+    mapped_size_ = 2 * channel_size;
+    void *memory = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED){
+        throw WorkerProcessError{"unable to map memory shared with the worker process"};
+    }
+    requests_ = static_cast<Channel *>(memory);
+    responses_ = reinterpret_cast<Channel *>(static_cast<char *>(memory) + channel_size);
+
+    pthread_mutexattr_t mutex_attributes;
+    pthread_mutexattr_init(&mutex_attributes);
+    pthread_mutexattr_setpshared(&mutex_attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_condattr_t condition_attributes;
+    pthread_condattr_init(&condition_attributes);
+    pthread_condattr_setpshared(&condition_attributes, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&condition_attributes, CLOCK_MONOTONIC);
+    for(Channel *channel : {requests_, responses_}){
+        pthread_mutex_init(&channel->mutex, &mutex_attributes);
+        pthread_cond_init(&channel->readable, &condition_attributes);
+        pthread_cond_init(&channel->writable, &condition_attributes);
+        channel->capacity = buffer_size;
+        channel->read_position = 0;
+        channel->write_position = 0;
+    }
+    pthread_mutexattr_destroy(&mutex_attributes);
+    pthread_condattr_destroy(&condition_attributes);
+
+    pid_t process_id = fork();
+    if(process_id == -1){
+        munmap(memory, mapped_size_);
+        throw WorkerProcessError{"unable to fork worker process"};
+    }else if(process_id == 0){
+        serve();
+    }
+    process_id_ = static_cast<int>(process_id);
+}
+
+void WorkerProcess::serve(){
+    int exit_status = 0;
+    try{
+        Py_Initialize();
+        {
+            using namespace boost::python;
+            object pickle = import("pickle");
+            while(true){
+                string request = read_message(*requests_);
+                if(request.empty() || static_cast<RequestType>(request[0]) != RequestType::RUN){
+                    break;
+                }
+                size_t offset = 1;
+                Source::Id id = parse_string(request, offset);
+                string arguments = parse_string(request, offset);
+                string response;
+                if(!sources_.has_source(id)){
+                    response.push_back(static_cast<char>(ResponseStatus::NO_SUCH_SOURCE));
+                }else{
+                    try{
+                        SourceRef source = sources_.get_source(id);
+                        object locals = pickle.attr("loads")(to_bytes(arguments));
+                        handle<>{PyEval_EvalCode(source->compiled_code().ptr(), source->module_namespace().ptr(), locals.ptr())};
+                        response.push_back(static_cast<char>(ResponseStatus::SUCCESS));
+                        append_bytes(response, pickle_locals(pickle, locals));
+                    }catch(error_already_set &e){
+                        string error = format_python_error();
+                        response.assign(1, static_cast<char>(ResponseStatus::SCRIPT_ERROR));
+                        append_string(response, error.data(), error.size());
+                    }catch(SourceError &e){
+                        string error{e.what()};
+                        response.assign(1, static_cast<char>(ResponseStatus::SCRIPT_ERROR));
+                        append_string(response, error.data(), error.size());
+                    }
+                }
+                write_message(*responses_, response);
+            }
+        }
+        Py_Finalize();
+    }catch(...){
+        exit_status = 1;
+    }
+    // Never return into the parent's code or run it's exit handlers
+    _exit(exit_status);
+}
+
+bool WorkerProcess::peer_alive() const{
+    if(getpid() == parent_process_id_){
+        return waitpid(static_cast<pid_t>(process_id_), nullptr, WNOHANG) == 0;
+    }else{
+        return getppid() == parent_process_id_;
+    }
+}
+
+void WorkerProcess::write(Channel &channel, const char *data, size_t size){
+    lock(channel.mutex);
+    size_t written = 0;
+    while(written < size){
+        size_t available = channel.capacity - (channel.write_position - channel.read_position);
+        if(available == 0){
+            timed_wait(channel.writable, channel.mutex);
+            if(channel.capacity == channel.write_position - channel.read_position && !peer_alive()){
+                pthread_mutex_unlock(&channel.mutex);
+                throw WorkerProcessError{"worker process stopped responding"};
+            }
+            continue;
+        }
+        size_t chunk = min(available, size - written);
+        size_t offset = channel.write_position % channel.capacity;
+        size_t first = min(chunk, channel.capacity - offset);
+        memcpy(channel.data() + offset, data + written, first);
+        memcpy(channel.data(), data + written + first, chunk - first);
+        channel.write_position += chunk;
+        written += chunk;
+        pthread_cond_signal(&channel.readable);
+    }
+    pthread_mutex_unlock(&channel.mutex);
+}
+
+void WorkerProcess::read(Channel &channel, char *data, size_t size){
+    lock(channel.mutex);
+    size_t read = 0;
+    while(read < size){
+        size_t available = channel.write_position - channel.read_position;
+        if(available == 0){
+            timed_wait(channel.readable, channel.mutex);
+            if(channel.write_position == channel.read_position && !peer_alive()){
+                pthread_mutex_unlock(&channel.mutex);
+                throw WorkerProcessError{"worker process stopped responding"};
+            }
+            continue;
+        }
+        size_t chunk = min(available, size - read);
+        size_t offset = channel.read_position % channel.capacity;
+        size_t first = min(chunk, channel.capacity - offset);
+        memcpy(data + read, channel.data() + offset, first);
+        memcpy(data + read + first, channel.data(), chunk - first);
+        channel.read_position += chunk;
+        read += chunk;
+        pthread_cond_signal(&channel.writable);
+    }
+    pthread_mutex_unlock(&channel.mutex);
+}
+
+void WorkerProcess::write_message(Channel &channel, const string &message){
+    uint64_t size = message.size();
+    write(channel, reinterpret_cast<const char *>(&size), sizeof(size));
+    write(channel, message.data(), message.size());
+}
+
+string WorkerProcess::read_message(Channel &channel){
+    uint64_t size = 0;
+    read(channel, reinterpret_cast<char *>(&size), sizeof(size));
+    string message(size, '\0');
+    read(channel, &message[0], message.size());
+    return message;
+}
+
+void WorkerProcess::execute(const Source &source, boost::python::object locals){
+    using namespace boost::python;
+    object pickle = import("pickle");
+    string request;
+    request.push_back(static_cast<char>(RequestType::RUN));
+    append_string(request, source.id().data(), source.id().size());
+    object protocol = pickle.attr("HIGHEST_PROTOCOL");
+    append_bytes(request, pickle.attr("dumps")(locals, protocol));
+    string response;
+    {
+        GILRelease gil_release;
+        write_message(*requests_, request);
+        response = read_message(*responses_);
+    }
+    if(response.empty()){
+        throw WorkerProcessError{"empty response from worker process"};
+    }
+    size_t offset = 1;
+    switch(static_cast<ResponseStatus>(response[0])){
+        case ResponseStatus::SUCCESS:
+            {
+                object result = pickle.attr("loads")(to_bytes(parse_string(response, offset)));
+                locals.attr("clear")();
+                locals.attr("update")(result);
+            }
+            break;
+        case ResponseStatus::NO_SUCH_SOURCE:
+            throw NoSuchSourceError{source.id()};
+        default:
+            throw RemoteScriptError{source.id(), parse_string(response, offset)};
+    }
+}
+
+WorkerProcess::~WorkerProcess(){
+    try{
+        write_message(*requests_, string(1, static_cast<char>(RequestType::STOP)));
+    }catch(WorkerProcessError &e){
+        kill(static_cast<pid_t>(process_id_), SIGKILL);
+    }
+    // The caller may hold the GIL and the script system's locks, so a process that does not exit, e.g. because of a runaway script, must not block it forever
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + stop_timeout;
+    while(waitpid(static_cast<pid_t>(process_id_), nullptr, WNOHANG) == 0){
+        if(chrono::steady_clock::now() >= deadline){
+            kill(static_cast<pid_t>(process_id_), SIGKILL);
+            waitpid(static_cast<pid_t>(process_id_), nullptr, 0);
+            break;
+        }
+        this_thread::sleep_for(chrono::milliseconds{1});
+    }
+    munmap(requests_, mapped_size_);
+}
+
+#else
+
+WorkerProcess::WorkerProcess(const SourceManager &sources, size_t) : sources_(sources), requests_(), responses_(), mapped_size_(), process_id_(), parent_process_id_(){
+    throw WorkerProcessError{"worker processes are only supported on unix like systems"};
+}
+
+void WorkerProcess::execute(const Source &source, boost::python::object){
+    throw WorkerProcessError{"worker processes are only supported on unix like systems"};
+}
+
+WorkerProcess::~WorkerProcess(){}
+
+#endif
@@ -0,0 +1,138 @@
+///
+/// Contains types to run scripts in separate worker processes
+///
+
+#ifndef PYTHON_CPP_UTILITY_PROCESS_H
+#define	PYTHON_CPP_UTILITY_PROCESS_H
+
+#include "Source.h"
+
+#include <chrono>
+#include <string>
+
+#include <boost/python.hpp>
+
+namespace PythonCppUtility {
+
+    ///
+    /// An error that is thrown when a worker process could not be started or stopped responding
+    ///
+    class WorkerProcessError : public ScriptError {
+    public:
+        using ScriptError::ScriptError;
+    };
+
+    ///
+    /// An error that is thrown to the calling thread when a script raised a python error in a worker process
+    /// The message contains the formatted python traceback
+    ///
+    class RemoteScriptError : public SourceError {
+    public:
+        ///
+        /// Creates a new error
+        /// \param id the ID of the source that raised the error
+        /// \param traceback the formatted python error
+        ///
+        RemoteScriptError(const Source::Id &id, const std::string &traceback);
+    };
+
+    ///
+    /// A forked process with it's own python interpreter, used by the script system to run scripts on multiple cores without sharing a GIL
+    /// The process only knows the sources that were added to the source manager before it was forked
+    /// Runs are shipped to the process over a pair of shared memory ring buffers: the local dictionary filled by the before callback is pickled, the script runs in the worker process and the picklable part of the resulting local dictionary is sent back
+    /// Only supported on unix like systems
+    /// A process that died, e.g. because a script crashed the interpreter, is not replaced: all later runs of it's worker fail with WorkerProcessError until the script system is restarted
+    ///
+    class WorkerProcess {
+    public:
+
+        ///
+        /// The default size in bytes of each of the ring buffers shared with the process
+        ///
+        static const std::size_t default_buffer_size = 1 << 20;
+
+        ///
+        /// The time the destructor waits for the process to exit before it is killed
+        ///
+        static const std::chrono::milliseconds stop_timeout;
+
+        ///
+        /// Forks a new worker process
+        /// Should be called before the interpreter is initialized in the calling process and before any worker threads are started
+        /// The modules to be used by the scripts should be registered with ModuleManager::import_modules() before the process is forked
+        /// \param sources the sources the worker process can execute
+        /// \param buffer_size the size in bytes of each of the ring buffers shared with the process, messages larger than this are transferred in chunks
+        /// \throw WorkerProcessError if the process could not be forked
+        ///
+        WorkerProcess(const SourceManager &sources, std::size_t buffer_size = default_buffer_size);
+
+        ///
+        /// Binds the calling thread to this process: all scripts run by this thread will be executed by the process
+        ///
+        void attach();
+
+        ///
+        /// Unbinds the calling thread from this process
+        ///
+        void detach();
+
+        ///
+        /// Executes a source in the worker process and waits for it to finish
+        /// Should be called while the GIL is held, the GIL is released while waiting
+        /// \param source the source to execute, the worker process looks it up by it's ID
+        /// \param locals the local dictionary of the script, will be replaced by the picklable part of the resulting local dictionary
+        /// \throw NoSuchSourceError if the worker process does not know the source
+        /// \throw RemoteScriptError if the script raised a python error
+        /// \throw WorkerProcessError if the process stopped responding or died earlier
+        /// \throw boost::python::error_already_set if the local dictionary could not be pickled
+        ///
+        void execute(const Source &source, boost::python::object locals);
+
+        ///
+        /// \return the system's process ID of the worker process
+        ///
+        int process_id() const;
+
+        ///
+        /// \return the worker process the calling thread is attached to, or nullptr if none
+        ///
+        static WorkerProcess *current();
+
+        ///
+        /// Stops the worker process and waits for it to exit
+        /// A process that does not exit within stop_timeout, e.g. because a script is still running, is killed
+        ///
+        ~WorkerProcess();
+
+    private:
+        struct Channel;
+
+        const SourceManager &sources_;
+        Channel *requests_;
+        Channel *responses_;
+        std::size_t mapped_size_;
+        int process_id_;
+        int parent_process_id_;
+
+        static thread_local WorkerProcess *current_;
+
+        void serve();
+
+        bool peer_alive() const;
+
+        void write(Channel &channel, const char *data, std::size_t size);
+
+        void read(Channel &channel, char *data, std::size_t size);
+
+        void write_message(Channel &channel, const std::string &message);
+
+        std::string read_message(Channel &channel);
+
+        WorkerProcess(const WorkerProcess &) = delete;
+        WorkerProcess &operator=(const WorkerProcess &) = delete;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_PROCESS_H */
+
@@ -0,0 +1,126 @@
+///
+/// Contains a lock free queue used by the scheduler to pass tasks to the worker threads
+///
+
+#ifndef PYTHON_CPP_UTILITY_QUEUE_H
+#define	PYTHON_CPP_UTILITY_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+namespace PythonCppUtility {
+
+    ///
+    /// A bounded multi-producer, multi-consumer queue that does not use any locks
+    /// Each slot carries a sequence number telling producers and consumers whether it is free or filled for their turn, so they only contend on a single atomic counter each
+    /// This type is thread safe
+    /// \tparam T the type of the elements, should be cheap to copy (e.g. a pointer)
+    ///
+    template<typename T> class BoundedQueue {
+    public:
+
+        ///
+        /// Creates a new queue
+        /// \param capacity the minimum number of elements the queue can hold, rounded up to the next power of two
+        ///
+        explicit BoundedQueue(std::size_t capacity) : cells_(), mask_(), enqueue_position_(0), dequeue_position_(0){
+            std::size_t size = 2;
+            while(size < capacity){
+                size <<= 1;
+            }
+            cells_.reset(new Cell[size]);
+            mask_ = size - 1;
+            for(std::size_t i = 0; i < size; ++i){
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        ///
+        /// Adds an element to the back of the queue if it is not full
+        /// This method does not block
+        /// \param value the element
+        /// \return true if the element was added, false if the queue was full
+        ///
+        bool try_push(const T &value){
+            std::size_t position = enqueue_position_.load(std::memory_order_relaxed);
+            while(true){
+                Cell &cell = cells_[position & mask_];
+                std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+                if(difference == 0){
+                    if(enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+                        cell.value = value;
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }else if(difference < 0){
+                    return false;
+                }else{
+                    position = enqueue_position_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        ///
+        /// Removes the element at the front of the queue if it is not empty
+        /// This method does not block
+        /// \param value set to the removed element
+        /// \return true if an element was removed, false if the queue was empty
+        ///
+        bool try_pop(T &value){
+            std::size_t position = dequeue_position_.load(std::memory_order_relaxed);
+            while(true){
+                Cell &cell = cells_[position & mask_];
+                std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+                if(difference == 0){
+                    if(dequeue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+                        value = cell.value;
+                        cell.sequence.store(position + mask_ + 1, std::memory_order_release);
+                        return true;
+                    }
+                }else if(difference < 0){
+                    return false;
+                }else{
+                    position = dequeue_position_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        ///
+        /// \return the approximate number of elements in the queue, only exact if no other thread modifies the queue
+        ///
+        std::size_t size() const{
+            std::size_t enqueued = enqueue_position_.load(std::memory_order_acquire);
+            std::size_t dequeued = dequeue_position_.load(std::memory_order_acquire);
+            return enqueued > dequeued ? enqueued - dequeued : 0;
+        }
+
+        ///
+        /// \return the maximum number of elements the queue can hold
+        ///
+        std::size_t capacity() const{
+            return mask_ + 1;
+        }
+
+    private:
+
+        struct Cell {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<Cell[]> cells_;
+        std::size_t mask_;
+        alignas(64) std::atomic<std::size_t> enqueue_position_;
+        alignas(64) std::atomic<std::size_t> dequeue_position_;
+
+        BoundedQueue(const BoundedQueue &) = delete;
+        BoundedQueue &operator=(const BoundedQueue &) = delete;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_QUEUE_H */
+
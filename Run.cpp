@@ -1,4 +1,8 @@
 #include "Run.h"
+#include "Interpreter.h"
+#include "Process.h"
+#include "RunHandle.h"
+#include "GILProfiler.h"
 
 #include <boost/python.hpp>
 
@@ -6,34 +10,148 @@ using namespace PythonCppUtility;
 
 using namespace std;
 
-Run::Run(SourceRef source, Run::BeforeCallback before, Run::AfterCallback after) : source_(source), before_(before), after_(after), done_(), done_promise_(){}
+Run::Deadline Run::no_deadline(){
+    return Deadline::max();
+}
+
+Run::Run(SourceRef source, Priority priority, Deadline deadline, MemoryPoolRef pool) : source_(move(source)), priority_(priority), deadline_(deadline), created_(chrono::steady_clock::now()), started_(created_), latencies_recorded_(false), done_(), done_promise_(allocator_arg, PoolAllocator<bool>{pool}), completion_(), control_(), pool_(), allocation_size_(0){}
+
+void Run::destroy(Run *run){
+    MemoryPoolRef pool = move(run->pool_);
+    if(pool){
+        size_t allocation_size = run->allocation_size_;
+        run->~Run();
+        pool->deallocate(run, allocation_size);
+    }else{
+        delete run;
+    }
+}
+
+SourceRef Run::source() const{
+    return source_;
+}
+
+Run::Priority Run::priority() const{
+    return priority_;
+}
+
+Run::Deadline Run::deadline() const{
+    return deadline_;
+}
 
-void Run::operator()(){
+void Run::evaluate(boost::python::object globals, boost::python::object locals){
     using namespace boost::python;
-    bool result = false;
-    GILGuard gil_guard;
+    WorkerProcess *process = WorkerProcess::current();
+    enter_evaluation(process == nullptr);
     try{
-        object module = import("__main__");
-        object globals = module.attr("__dict__");
-        dict locals;
-        before_(locals);
-        exec(source_->code(), globals, locals);
-        after_(locals);
-        result = true;
-    }catch(boost::python::error_already_set &e){
-        PyErr_Print();
-        done_promise_.set_exception(current_exception());
+        if(process){
+            process->execute(*source_, locals);
+        }else{
+            handle<>{PyEval_EvalCode(source_->compiled_code().ptr(), globals.ptr(), locals.ptr())};
+        }
     }catch(...){
-        done_promise_.set_exception(current_exception());
+        // Loading the source can fail with a C++ exception too, the run must not stay interruptible once it's worker moved on
+        leave_evaluation();
+        throw;
+    }
+    leave_evaluation();
+}
+
+boost::python::object Run::call(const string &function, PyObject *const *arguments, size_t count){
+    using namespace boost::python;
+    if(WorkerProcess::current()){
+        throw SourceError{source_->id(), "functions can not be called in worker processes: " + source_->id()};
     }
-    if(result){
+    object module = source_->module();
+    PyObject *callable = PyDict_GetItemString(module.ptr(), function.c_str());
+    if(!callable){
+        PyErr_Format(PyExc_NameError, "name '%s' is not defined in %s", function.c_str(), source_->id().c_str());
+        throw_error_already_set();
+    }
+    // Keep the function alive in case the module is replaced while it runs
+    object callable_object{handle<>{borrowed(callable)}};
+    enter_evaluation(true);
+    PyObject *result;
+    try{
+#if PY_VERSION_HEX >= 0x03090000
+        result = PyObject_Vectorcall(callable, arguments, count, nullptr);
+#else
+        handle<> tuple{PyTuple_New(static_cast<Py_ssize_t>(count))};
+        for(size_t i = 0; i < count; ++i){
+            Py_INCREF(arguments[i]);
+            PyTuple_SET_ITEM(tuple.get(), i, arguments[i]);
+        }
+        result = PyObject_Call(callable, tuple.get(), nullptr);
+#endif
+        if(!result){
+            throw_error_already_set();
+        }
+    }catch(error_already_set &){
+        leave_evaluation();
+        throw;
+    }
+    object result_object{handle<>{result}};
+    leave_evaluation();
+    return result_object;
+}
+
+void Run::enter_evaluation(bool interruptible){
+    if(control_ && !control_->enter_evaluation(interruptible)){
+        throw RunCancelledError{source_->id()};
+    }
+}
+
+void Run::leave_evaluation(){
+    if(control_ && !control_->leave_evaluation()){
+        // A pending python error is the interruption raised by the cancellation
+        PyErr_Clear();
+        throw RunCancelledError{source_->id()};
+    }
+}
+
+void Run::finish(exception_ptr error){
+    if(control_){
+        control_->finished();
+    }
+    if(error){
+        done_promise_.set_exception(error);
+    }else{
         done_promise_.set_value(true);
     }
     done_ = true;
+    if(completion_.valid()){
+        completion_.complete(error);
+    }
+}
+
+void Run::completion(Completion completion){
+    completion_ = move(completion);
+}
+
+void Run::control(shared_ptr<RunControl> control){
+    control_ = move(control);
+}
+
+bool Run::start(){
+    started_ = chrono::steady_clock::now();
+    return !control_ || control_->start();
+}
+
+void Run::record_latencies(chrono::steady_clock::time_point gil_acquired, chrono::steady_clock::time_point before_done, chrono::steady_clock::time_point evaluated, chrono::steady_clock::time_point after_done){
+    RunLatencies &latencies = source_->latencies();
+    if(!latencies_recorded_){
+        latencies.queued.record(started_ - created_);
+        latencies.gil_wait.record(gil_acquired - started_);
+        latencies_recorded_ = true;
+    }
+    latencies.before.record(before_done - gil_acquired);
+    latencies.execution.record(evaluated - before_done);
+    latencies.after.record(after_done - evaluated);
+    latencies.total.record(after_done - created_);
 }
 
 void Run::flag_error(){
-    done_promise_.set_exception(current_exception());
+    finish(current_exception());
 }
 
 std::future<bool> Run::create_future(){
@@ -42,16 +160,166 @@ std::future<bool> Run::create_future(){
 
 Run::~Run(){
     if(!done_){
-        done_promise_.set_exception(make_exception_ptr(RunCancelledError{source_->id()}));
+        finish(make_exception_ptr(RunCancelledError{source_->id()}));
     }
 }
 
-GILGuard::GILGuard(){
-    state_ = PyGILState_Ensure();
+namespace{
+    ///
+    /// The number of nested guards of a thread with a persistent thread state, PyEval_RestoreThread can not be nested like PyGILState_Ensure
+    ///
+    thread_local size_t thread_state_guard_depth = 0;
+
+#if PYTHON_CPP_UTILITY_GIL_PROFILER
+    ///
+    /// The number of nested guards of the calling thread, only the outermost one is profiled
+    ///
+    thread_local size_t profiled_guard_depth = 0;
+#endif
+}
+
+GILGuard::GILGuard() : GILGuard("unnamed"){}
+
+PyThreadState *GILGuard::persistent_thread_state(){
+    PyThreadState *thread_state = SubInterpreter::thread_state();
+    return thread_state ? thread_state : MainInterpreterThread::thread_state();
+}
+
+#if PYTHON_CPP_UTILITY_GIL_PROFILER
+GILGuard::GILGuard(const char *call_site) : state_(), thread_state_(persistent_thread_state()), call_site_(call_site), profiled_(profiled_guard_depth++ == 0), requested_(chrono::steady_clock::now()), acquired_(){
+#else
+GILGuard::GILGuard(const char *call_site) : state_(), thread_state_(persistent_thread_state()), call_site_(call_site), profiled_(false), requested_(), acquired_(){
+#endif
+    if(thread_state_){
+        if(thread_state_guard_depth++ == 0){
+            PyEval_RestoreThread(thread_state_);
+            CachedObject::release_pending();
+        }
+    }else{
+        state_ = PyGILState_Ensure();
+    }
+#if PYTHON_CPP_UTILITY_GIL_PROFILER
+    acquired_ = chrono::steady_clock::now();
+#endif
 }
 
 GILGuard::~GILGuard() {
-    PyGILState_Release(state_);
+#if PYTHON_CPP_UTILITY_GIL_PROFILER
+    chrono::steady_clock::time_point released = chrono::steady_clock::now();
+#endif
+    if(thread_state_){
+        if(--thread_state_guard_depth == 0){
+            PyEval_SaveThread();
+        }
+    }else{
+        PyGILState_Release(state_);
+    }
+#if PYTHON_CPP_UTILITY_GIL_PROFILER
+    --profiled_guard_depth;
+    if(profiled_){
+        GILProfiler::record(call_site_, acquired_ - requested_, released - acquired_);
+    }
+#endif
+}
+
+namespace{
+    thread_local bool locals_pool_open = false;
+
+    thread_local vector<PyObject *> locals_pool;
+}
+
+void LocalsPool::open(){
+    locals_pool_open = true;
+}
+
+void LocalsPool::close(){
+    for(PyObject *locals : locals_pool){
+        Py_DECREF(locals);
+    }
+    locals_pool.clear();
+    locals_pool_open = false;
+}
+
+boost::python::object LocalsPool::acquire(){
+    using namespace boost::python;
+    if(locals_pool.empty()){
+        return dict{};
+    }
+    PyObject *locals = locals_pool.back();
+    locals_pool.pop_back();
+    return object{handle<>{locals}};
+}
+
+void LocalsPool::release(boost::python::object &locals){
+    PyObject *dictionary = locals.ptr();
+    if(locals_pool_open && locals_pool.size() < capacity && Py_REFCNT(dictionary) == 1){
+        PyDict_Clear(dictionary);
+        // Clearing may run finalizers of the script's objects, which could have taken a reference
+        if(Py_REFCNT(dictionary) == 1){
+            locals_pool.push_back(boost::python::incref(dictionary));
+        }
+    }
+    locals = boost::python::object{};
+}
+
+const chrono::microseconds BatchRun::default_time_slice{5000};
+
+BatchRun::BatchRun(SourceRef source, vector<Item> items, chrono::microseconds time_slice, Priority priority, Deadline deadline, MemoryPoolRef pool) : Run(move(source), priority, deadline, move(pool)), items_(move(items)), item_promises_(items_.size()), time_slice_(time_slice), completed_(0){}
+
+void BatchRun::operator()(){
+    using namespace boost::python;
+    exception_ptr first_error;
+    while(completed_ < items_.size()){
+        GILGuard gil_guard{"BatchRun"};
+        chrono::steady_clock::time_point slice_end = chrono::steady_clock::now() + time_slice_;
+        object globals = source()->module_namespace();
+        do{
+            exception_ptr error;
+            try{
+                execute(globals, items_[completed_].first, items_[completed_].second);
+            }catch(boost::python::error_already_set &e){
+                PyErr_Print();
+                error = current_exception();
+            }catch(...){
+                error = current_exception();
+            }
+            if(error){
+                item_promises_[completed_].set_exception(error);
+                if(!first_error){
+                    first_error = error;
+                }
+            }else{
+                item_promises_[completed_].set_value(true);
+            }
+            ++completed_;
+        }while(completed_ < items_.size() && chrono::steady_clock::now() < slice_end);
+    }
+    finish(first_error);
+}
+
+vector<future<bool>> BatchRun::create_item_futures(){
+    vector<future<bool>> futures;
+    futures.reserve(item_promises_.size());
+    for(promise<bool> &item_promise : item_promises_){
+        futures.push_back(item_promise.get_future());
+    }
+    return futures;
+}
+
+void BatchRun::finish(exception_ptr error){
+    // The run is only finished before all inputs were executed if it was discarded, e.g. rejected or dropped by the scheduler or cancelled
+    for(; completed_ < item_promises_.size(); ++completed_){
+        item_promises_[completed_].set_exception(error ? error : make_exception_ptr(RunCancelledError{source()->id()}));
+    }
+    Run::finish(error);
+}
+
+BatchRun::~BatchRun(){
+    for(size_t i = completed_; i < item_promises_.size(); ++i){
+        item_promises_[i].set_exception(make_exception_ptr(RunCancelledError{source()->id()}));
+    }
 }
 
 RunCancelledError::RunCancelledError(const Source::Id& id) : SourceError(id, string{"script run cancelled: "}+ id){};
+
+QueueFullError::QueueFullError(const Source::Id& id) : SourceError(id, string{"script run rejected, the queue is full: "} + id){}
@@ -6,15 +6,32 @@
 #define	PYTHON_CPP_UTILITY_RUN_H
 
 #include "Source.h"
+#include "MemoryPool.h"
+#include "Completion.h"
+#include "Buffer.h"
 
 #include <functional>
 #include <future>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <type_traits>
+#include <new>
+#include <string>
+#include <tuple>
 
 #include <boost/python.hpp>
 
 namespace PythonCppUtility{
+        class RunControl;
+
         ///
         /// A guard type to lock and unlock Python's interpreter lock using the RAII pattern
+        /// If the calling thread is attached to a sub-interpreter, that interpreter's GIL is locked instead of the main interpreter's
+        /// If the calling thread has a persistent thread state (see SubInterpreter and MainInterpreterThread), it is restored instead of using the GIL state API
+        /// If the library is built with PYTHON_CPP_UTILITY_GIL_PROFILER defined, the outermost guard of each thread records it's wait and hold times with the GILProfiler
         ///
         class GILGuard{
         public:
@@ -24,12 +41,27 @@ namespace PythonCppUtility{
                 ///
                 GILGuard();
 
+                ///
+                /// Creates a new guard object, blocking the thread until the GIL can be acquired
+                /// \param call_site the name the profiler records the guard's times under, a string that lives as long as the process. Ignored if the profiler is disabled
+                ///
+                explicit GILGuard(const char *call_site);
+
                 ///
                 /// Destroys the guard object, releases GIL
                 ///	
                 ~GILGuard();
         private:
                 PyGILState_STATE state_;
+                PyThreadState *thread_state_;
+
+                // The profiler's members are kept even if it is disabled, so the guard's layout does not depend on how the including code is built
+                const char *call_site_;
+                bool profiled_;
+                std::chrono::steady_clock::time_point requested_;
+                std::chrono::steady_clock::time_point acquired_;
+
+                static PyThreadState *persistent_thread_state();
 
                 GILGuard(const GILGuard &) = delete;
                 GILGuard &operator=(const GILGuard &) = delete;
@@ -47,6 +79,60 @@ namespace PythonCppUtility{
                 RunCancelledError(const Source::Id &id);
         };
 
+        ///
+        /// An error that is thrown to the calling thread when a run is rejected or dropped because the scheduler's queue is full
+        ///
+        class QueueFullError : public SourceError{
+        public:
+                ///
+                /// Creates a new error
+                /// \param id the source id of the rejected run
+                ///
+                QueueFullError(const Source::Id &id);
+        };
+
+        ///
+        /// The local dictionaries of a worker thread, cleared and reused by the runs the worker executes instead of allocating a new dictionary for each run
+        /// A dictionary is only reused if nothing else references it after the run, e.g. a traceback or an after callback that kept it
+        /// The pool is disabled for threads that did not open it, so dictionaries are never kept by threads that can not release them
+        /// This type should not be used by the library's user and is only for internal housekeeping
+        ///
+        class LocalsPool{
+        public:
+
+                ///
+                /// The maximum number of dictionaries kept by a thread
+                ///
+                static const std::size_t capacity = 4;
+
+                ///
+                /// Enables the pool for the calling thread, called by the worker callbacks when a worker starts
+                ///
+                static void open();
+
+                ///
+                /// Releases the calling thread's dictionaries and disables it's pool, called by the worker callbacks before a worker stops
+                /// Should be called while the GIL of the thread's interpreter is held
+                ///
+                static void close();
+
+                ///
+                /// Should only be called while the GIL is held
+                /// \return an empty dictionary from the calling thread's pool, or a new dictionary
+                ///
+                static boost::python::object acquire();
+
+                ///
+                /// Clears a dictionary and returns it to the calling thread's pool, if the pool is enabled and not full
+                /// Should only be called while the GIL is held
+                /// \param locals the dictionary, reset to None
+                ///
+                static void release(boost::python::object &locals);
+
+        private:
+                LocalsPool() = delete;
+        };
+
         ///
         /// A type modelling a single script execution.
         /// This type should not be used by the library's user and is only for internal housekeeping
@@ -66,19 +152,104 @@ namespace PythonCppUtility{
                 ///
                 using AfterCallback = std::function<void (boost::python::object locals)>;
 
+                ///
+                /// An enumeration type representing the priority class of a run
+                /// Queued runs of a higher class are executed before those of a lower class
+                ///
+                enum class Priority {
+                        ///
+                        /// For batch work that can wait for everything else
+                        ///
+                        LOW,
+                        ///
+                        /// The default priority class
+                        ///
+                        NORMAL,
+                        ///
+                        /// For latency sensitive work, e.g. interactive calls
+                        ///
+                        HIGH
+                };
+
+                ///
+                /// The number of priority classes
+                ///
+                static const std::size_t priority_count = 3;
+
+                ///
+                /// The type of the point in time a run should be started by
+                /// Within a priority class, queued runs with an earlier deadline are executed first
+                ///
+                using Deadline = std::chrono::steady_clock::time_point;
+
+                ///
+                /// \return the deadline of runs without a deadline, which are executed after all runs of the same priority class that have one
+                ///
+                static Deadline no_deadline();
+
+                ///
+                /// A callback that does nothing, used when no before or after callback is given
+                ///
+                struct NoCallback{
+                        void operator() (boost::python::object) const{}
+                };
+
                 ///
                 /// Creates a new Run object 
-                /// The before and after callbacksare executed when the script execution thread has acquired Python's interpreter lock and should be used to respectively put arguments in and extract results from the script's local dictionary
                 /// \param source a reference to the source buffer
-                /// \param before a callback to be executed before the script run is executed
-                /// \param after a callback to be executed after the script is executed
+                /// \param priority the priority class of the run
+                /// \param deadline the point in time the run should be started by
+                /// \param pool the pool to allocate the shared state of the run's future from, or an empty reference to use the heap
+                ///
+                Run(SourceRef source, Priority priority = Priority::NORMAL, Deadline deadline = no_deadline(), MemoryPoolRef pool = MemoryPoolRef{});
+
+                ///
+                /// Creates a new run in memory taken from a pool, the run and the shared state of it's future are recycled by the pool once they are destroyed
+                /// Runs created by this method should be destroyed by destroy()
+                /// \tparam RunType the type of the run, derived from Run
+                /// \param pool the pool to allocate from, it is passed to the run's constructor after the other arguments
+                /// \param arguments the arguments for the run's constructor
+                /// \return the new run
+                ///
+                template<typename RunType, typename... Arguments> static RunType *create(MemoryPoolRef pool, Arguments &&...arguments){
+                        void *memory = pool->allocate(sizeof(RunType));
+                        RunType *run;
+                        try{
+                                run = new (memory) RunType{std::forward<Arguments>(arguments)..., pool};
+                        }catch(...){
+                                pool->deallocate(memory, sizeof(RunType));
+                                throw;
+                        }
+                        run->allocation_size_ = sizeof(RunType);
+                        run->pool_ = std::move(pool);
+                        return run;
+                }
+
+                ///
+                /// Destroys a run and returns it's memory to the pool it was created from, or to the heap if it was created by new
+                /// \param run the run to destroy
+                ///
+                static void destroy(Run *run);
+
                 ///
-                Run(SourceRef source, BeforeCallback before, AfterCallback after);
+                /// \return the source of the script to run
+                ///
+                SourceRef source() const;
+
+                ///
+                /// \return the priority class of the run
+                ///
+                Priority priority() const;
+
+                ///
+                /// \return the point in time the run should be started by
+                ///
+                Deadline deadline() const;
 
                 ///
                 /// blocks until Python's interpreter lock can be acquired and executes the script
                 ///
-                void operator() ();
+                virtual void operator() () = 0;
 
                 ///
                 /// Creates a future that can be used to wait for the result of this run.
@@ -87,25 +258,315 @@ namespace PythonCppUtility{
                 ///
                 std::future<bool> create_future();
 
+                ///
+                /// Sets the completion that is completed together with the run's future, after the GIL was released
+                /// Should be called before the run is submitted
+                /// \param completion the completion
+                ///
+                void completion(Completion completion);
+
+                ///
+                /// Sets the control used to cancel the run
+                /// Should be called before the run is submitted
+                /// \param control the control
+                ///
+                void control(std::shared_ptr<RunControl> control);
+
+                ///
+                /// Marks the run as started, called by the worker that dequeued it before executing it
+                /// The point in time the run was started is used to record it's queue latency
+                /// \return true if the run should be executed, false if it was cancelled and should only be destroyed
+                ///
+                bool start();
+
                 ///
                 /// Tells the run that an error has occurred and sets the future's exception to the current exception pointer
                 /// Should only be called from within a catch block
                 ///
                 void flag_error();
 
-                ~Run();
+                virtual ~Run();
+
+        protected:
+
+                ///
+                /// Executes the script once with an empty local dictionary from the worker's LocalsPool on top of the source's namespace and records the latencies of the execution in the source's histograms
+                /// Buffer views created by the callbacks are released when the execution ends, see BufferView
+                /// Should only be called while the GIL is held
+                /// \param globals the global dictionary of the script, the source's namespace
+                /// \param before the callback to fill the local dictionary
+                /// \param after the callback to read the results from the local dictionary
+                /// \throw boost::python::error_already_set if the script raised a python error
+                /// \throw BufferExportedError if the script kept a view of a buffer created by the callbacks
+                ///
+                template<typename Before, typename After> void execute(boost::python::object globals, Before &before, After &after){
+                        using Clock = std::chrono::steady_clock;
+                        Clock::time_point gil_acquired = Clock::now();
+                        Clock::time_point before_done;
+                        Clock::time_point evaluated;
+                        BufferView::Scope buffers;
+                        {
+                                boost::python::object locals = LocalsPool::acquire();
+                                before(locals);
+                                before_done = Clock::now();
+                                evaluate(globals, locals);
+                                evaluated = Clock::now();
+                                after(locals);
+                                LocalsPool::release(locals);
+                        }
+                        // The views are released after the local dictionary, so only views the script kept elsewhere are still exported
+                        buffers.release(source_->id());
+                        record_latencies(gil_acquired, before_done, evaluated, Clock::now());
+                }
+
+                ///
+                /// Runs the script in the calling thread's interpreter or worker process
+                /// Should only be called while the GIL is held
+                /// \param globals the global dictionary of the script
+                /// \param locals the local dictionary of the script
+                /// \throw boost::python::error_already_set if the script raised a python error
+                /// \throw RunCancelledError if the run was cancelled before or while the script was evaluated
+                ///
+                void evaluate(boost::python::object globals, boost::python::object locals);
+
+                ///
+                /// Calls a function defined by the source, loading the source as a module in the calling thread's interpreter on first use
+                /// Should only be called while the GIL is held
+                /// \param function the name of the function in the source's module
+                /// \param arguments the positional arguments
+                /// \param count the number of arguments
+                /// \throw boost::python::error_already_set if the function is not defined or raised a python error
+                /// \throw RunCancelledError if the run was cancelled before or while the function was called
+                /// \throw SourceError if the calling thread executes scripts in a worker process
+                /// \return the function's result
+                ///
+                boost::python::object call(const std::string &function, PyObject *const *arguments, std::size_t count);
+
+                ///
+                /// Records the latencies of an execution that succeeded in the source's histograms
+                /// The queue and GIL wait latencies are only recorded for the first execution of the run
+                /// \param gil_acquired the point in time the GIL was acquired
+                /// \param before_done the point in time the before callback returned
+                /// \param evaluated the point in time the script was evaluated
+                /// \param after_done the point in time the after callback returned
+                ///
+                void record_latencies(std::chrono::steady_clock::time_point gil_acquired, std::chrono::steady_clock::time_point before_done, std::chrono::steady_clock::time_point evaluated, std::chrono::steady_clock::time_point after_done);
+
+                ///
+                /// Completes the run's future and it's completion
+                /// Should be called after the GIL was released
+                /// \param error the error to propagate to the future, or nullptr if the run succeeded
+                ///
+                virtual void finish(std::exception_ptr error);
 
         private:
+
+                ///
+                /// Marks the start of the evaluation for the run's control, so a cancellation interrupts the script from now on
+                /// \param interruptible false if the script is evaluated by a worker process and can not be interrupted
+                /// \throw RunCancelledError if the run was cancelled before
+                ///
+                void enter_evaluation(bool interruptible);
+
+                ///
+                /// Marks the end of the evaluation for the run's control
+                /// \throw RunCancelledError if the run was cancelled during the evaluation, the python error raised by the interruption is cleared
+                ///
+                void leave_evaluation();
+
                 SourceRef source_;
-                std::function<void (boost::python::object locals)> before_;
-                std::function<void (boost::python::object locals)> after_;
+                Priority priority_;
+                Deadline deadline_;
+                std::chrono::steady_clock::time_point created_;
+                std::chrono::steady_clock::time_point started_;
+                bool latencies_recorded_;
                 bool done_;
                 std::promise<bool> done_promise_;
+                Completion completion_;
+                std::shared_ptr<RunControl> control_;
+                MemoryPoolRef pool_;
+                std::size_t allocation_size_;
 
+                friend class RunControl;
 
                 Run(const Run &) = delete;
                 Run &operator=(const Run &) = delete;
         };
+
+        ///
+        /// Tells whether a type can be used as before or after callback of a run, i.e. whether it can be called with the local dictionary
+        ///
+        template<typename Callback, typename = void> struct IsRunCallback : std::false_type{};
+
+        template<typename Callback> struct IsRunCallback<Callback, decltype(std::declval<Callback &>()(std::declval<boost::python::object>()), void())> : std::true_type{};
+
+        ///
+        /// A run that stores it's callbacks by their own type, so they are called without type erasure and stored without separate allocations
+        /// The script system uses Run::BeforeCallback and Run::AfterCallback as callback types for callbacks passed as std::function
+        /// This type should not be used by the library's user and is only for internal housekeeping
+        /// \tparam Before the type of the before callback
+        /// \tparam After the type of the after callback
+        ///
+        template<typename Before, typename After> class TypedRun : public Run{
+        public:
+
+                ///
+                /// Creates a new run
+                /// The before and after callbacks are executed when the script execution thread has acquired Python's interpreter lock and should be used to respectively put arguments in and extract results from the script's local dictionary
+                /// \param source a reference to the source buffer
+                /// \param before a callback to be executed before the script run is executed
+                /// \param after a callback to be executed after the script is executed
+                /// \param priority the priority class of the run
+                /// \param deadline the point in time the run should be started by
+                /// \param pool the pool to allocate the shared state of the run's future from, or an empty reference to use the heap
+                ///
+                TypedRun(SourceRef source, Before before, After after, Priority priority = Priority::NORMAL, Deadline deadline = no_deadline(), MemoryPoolRef pool = MemoryPoolRef{}) : Run(std::move(source), priority, deadline, std::move(pool)), before_(std::move(before)), after_(std::move(after)){}
+
+                void operator() () override{
+                        std::exception_ptr error;
+                        {
+                                GILGuard gil_guard{"TypedRun"};
+                                try{
+                                        execute(source()->module_namespace(), before_, after_);
+                                }catch(boost::python::error_already_set &e){
+                                        PyErr_Print();
+                                        error = std::current_exception();
+                                }catch(...){
+                                        error = std::current_exception();
+                                }
+                        }
+                        finish(error);
+                }
+
+        private:
+                Before before_;
+                After after_;
+        };
+
+        ///
+        /// A run that calls a function defined by the source instead of executing the source's code
+        /// The source is loaded as a module once per interpreter, each run is a single call of the function with the arguments converted to python objects
+        /// This type should not be used by the library's user and is only for internal housekeeping
+        /// \tparam After the type of the callback that receives the function's result
+        /// \tparam Arguments the types of the function's positional arguments, each convertible by boost::python::object's constructor
+        ///
+        template<typename After, typename... Arguments> class FunctionRun : public Run{
+        public:
+
+                ///
+                /// Creates a new run
+                /// \param source a reference to the source buffer
+                /// \param function the name of the function to call
+                /// \param after a callback that is called with the function's result while the GIL is held
+                /// \param arguments the function's positional arguments, converted when the run is executed
+                /// \param priority the priority class of the run
+                /// \param deadline the point in time the run should be started by
+                /// \param pool the pool to allocate the shared state of the run's future from, or an empty reference to use the heap
+                ///
+                FunctionRun(SourceRef source, std::string function, After after, std::tuple<Arguments...> arguments, Priority priority = Priority::NORMAL, Deadline deadline = no_deadline(), MemoryPoolRef pool = MemoryPoolRef{}) : Run(std::move(source), priority, deadline, std::move(pool)), function_(std::move(function)), after_(std::move(after)), arguments_(std::move(arguments)){}
+
+                void operator() () override{
+                        using Clock = std::chrono::steady_clock;
+                        std::exception_ptr error;
+                        {
+                                GILGuard gil_guard{"FunctionRun"};
+                                try{
+                                        Clock::time_point gil_acquired = Clock::now();
+                                        // One more element than arguments, arrays can not be empty
+                                        boost::python::object objects[sizeof...(Arguments) + 1];
+                                        PyObject *pointers[sizeof...(Arguments) + 1];
+                                        convert<0>(objects, pointers);
+                                        Clock::time_point before_done = Clock::now();
+                                        boost::python::object result = call(function_, pointers, sizeof...(Arguments));
+                                        Clock::time_point evaluated = Clock::now();
+                                        after_(result);
+                                        record_latencies(gil_acquired, before_done, evaluated, Clock::now());
+                                }catch(boost::python::error_already_set &e){
+                                        PyErr_Print();
+                                        error = std::current_exception();
+                                }catch(...){
+                                        error = std::current_exception();
+                                }
+                        }
+                        finish(error);
+                }
+
+        private:
+                template<std::size_t Index> typename std::enable_if<(Index == sizeof...(Arguments))>::type convert(boost::python::object *, PyObject **){}
+
+                template<std::size_t Index> typename std::enable_if<(Index < sizeof...(Arguments))>::type convert(boost::python::object *objects, PyObject **pointers){
+                        objects[Index] = boost::python::object{std::get<Index>(arguments_)};
+                        pointers[Index] = objects[Index].ptr();
+                        convert<Index + 1>(objects, pointers);
+                }
+
+                std::string function_;
+                After after_;
+                std::tuple<Arguments...> arguments_;
+        };
+
+        ///
+        /// A run that executes the same script for many inputs, one after the other in the same worker
+        /// The GIL is acquired once per time slice instead of once per input: when a time slice expires, the GIL is released so other threads can run and then acquired again for the remaining inputs
+        /// Each input gets it's own local dictionary, an input that fails does not stop the remaining inputs
+        /// This type should not be used by the library's user and is only for internal housekeeping
+        ///
+        class BatchRun : public Run{
+        public:
+
+                ///
+                /// The callbacks for a single input: the before callback puts the input in the local dictionary and the after callback fetches the result
+                ///
+                using Item = std::pair<BeforeCallback, AfterCallback>;
+
+                ///
+                /// The default maximum time the GIL is held for a batch without being released
+                ///
+                static const std::chrono::microseconds default_time_slice;
+
+                ///
+                /// Creates a new batch run
+                /// \param source a reference to the source buffer
+                /// \param items the callbacks for each input, in order of execution
+                /// \param time_slice the maximum time the GIL is held before it is released, the input that is running when the slice expires is always completed first
+                /// \param priority the priority class of the run
+                /// \param deadline the point in time the run should be started by
+                /// \param pool the pool to allocate the shared state of the run's future from, or an empty reference to use the heap
+                ///
+                BatchRun(SourceRef source, std::vector<Item> items, std::chrono::microseconds time_slice = default_time_slice, Priority priority = Priority::NORMAL, Deadline deadline = no_deadline(), MemoryPoolRef pool = MemoryPoolRef{});
+
+                ///
+                /// Executes the script for each of the inputs
+                /// The run's own future returns "true" when all inputs have been executed and propagates the first error if any of them failed
+                ///
+                void operator() () override;
+
+                ///
+                /// Creates a future for each input that can be used to wait for it's result
+                /// Can be called only once
+                /// \return the futures in the order of the inputs
+                ///
+                std::vector<std::future<bool>> create_item_futures();
+
+                ///
+                /// Cancels the inputs that were not yet executed
+                ///
+                ~BatchRun();
+
+        protected:
+
+                ///
+                /// Completes the run's future, the inputs that were not executed fail with the same error, e.g. QueueFullError if the run was shed
+                /// \param error the error to propagate to the futures, or nullptr if the run succeeded
+                ///
+                void finish(std::exception_ptr error) override;
+
+        private:
+                std::vector<Item> items_;
+                std::vector<std::promise<bool>> item_promises_;
+                std::chrono::microseconds time_slice_;
+                std::size_t completed_;
+        };
 }
 
 #endif	/* PYTHON_CPP_UTILITY_RUN_H */
@@ -0,0 +1,123 @@
+#include "RunHandle.h"
+#include "Scheduler.h"
+
+#include <thread>
+
+#include <pythread.h>
+
+using namespace PythonCppUtility;
+using namespace std;
+
+namespace{
+    PyInterpreterState *current_interpreter(){
+#if PY_VERSION_HEX >= 0x03090000
+        return PyThreadState_GetInterpreter(PyThreadState_Get());
+#else
+        return PyThreadState_Get()->interp;
+#endif
+    }
+
+    PyInterpreterState *main_interpreter(){
+#if PY_VERSION_HEX >= 0x03070000
+        return PyInterpreterState_Main();
+#else
+        // New interpreters are prepended to the list, the main interpreter is the last one
+        PyInterpreterState *interpreter = PyInterpreterState_Head();
+        while(PyInterpreterState_Next(interpreter)){
+            interpreter = PyInterpreterState_Next(interpreter);
+        }
+        return interpreter;
+#endif
+    }
+}
+
+RunControl::RunControl(Scheduler &scheduler, Run *run) : scheduler_(scheduler), run_(run), state_(State::QUEUED), interrupters_(0), thread_id_(0), interruptible_(false){}
+
+bool RunControl::cancel(){
+    State expected = State::QUEUED;
+    if(state_.compare_exchange_strong(expected, State::CANCELLING)){
+        // No worker executes or destroys the run until it is marked as cancelled, if it could not be removed the worker that dequeued it destroys it
+        bool removed = scheduler_.remove(run_);
+        Run *run = run_;
+        run->finish(make_exception_ptr(RunCancelledError{run->source()->id()}));
+        state_ = State::CANCELLED;
+        if(removed){
+            Run::destroy(run);
+        }
+        return true;
+    }
+    expected = State::STARTED;
+    if(state_.compare_exchange_strong(expected, State::INTERRUPTED)){
+        return true;
+    }
+    return expected == State::EVALUATING && interrupt();
+}
+
+bool RunControl::interrupt(){
+    // Announce the interruption before checking the state again, so the worker either sees it when it finishes or the evaluation already ended here
+    ++interrupters_;
+    bool interrupted = false;
+    if(state_ == State::EVALUATING && interruptible_){
+        GILGuard gil_guard{"RunControl::interrupt"};
+        State expected = State::EVALUATING;
+        if(state_.compare_exchange_strong(expected, State::INTERRUPTED)){
+            PyThreadState_SetAsyncExc(thread_id_, PyExc_KeyboardInterrupt);
+            interrupted = true;
+        }
+    }
+    --interrupters_;
+    return interrupted;
+}
+
+bool RunControl::start(){
+    State expected = State::QUEUED;
+    if(state_.compare_exchange_strong(expected, State::STARTED)){
+        return true;
+    }
+    while(state_ != State::CANCELLED){
+        this_thread::yield();
+    }
+    return false;
+}
+
+bool RunControl::enter_evaluation(bool interruptible){
+    thread_id_ = PyThread_get_thread_ident();
+    interruptible_ = interruptible && current_interpreter() == main_interpreter();
+    State expected = State::STARTED;
+    return state_.compare_exchange_strong(expected, State::EVALUATING);
+}
+
+bool RunControl::leave_evaluation(){
+    State expected = State::EVALUATING;
+    if(state_.compare_exchange_strong(expected, State::FINISHED)){
+        return true;
+    }
+    // The script may have ended before the interruption was raised, it must not hit the next script run by this thread
+    PyThreadState_SetAsyncExc(thread_id_, nullptr);
+    return false;
+}
+
+void RunControl::finished(){
+    State expected = State::QUEUED;
+    if(!state_.compare_exchange_strong(expected, State::FINISHED)){
+        expected = State::STARTED;
+        state_.compare_exchange_strong(expected, State::FINISHED);
+    }
+    while(interrupters_ != 0){
+        this_thread::yield();
+    }
+}
+
+RunHandle::RunHandle(future<bool> result, shared_ptr<RunControl> control) : result_(move(result)), control_(move(control)){}
+
+bool RunHandle::cancel(){
+    return control_->cancel();
+}
+
+future<bool> &RunHandle::result(){
+    return result_;
+}
+
+bool RunHandle::get(){
+    return result_.get();
+}
@@ -0,0 +1,140 @@
+///
+/// Contains the types used to cancel submitted script runs
+///
+
+#ifndef PYTHON_CPP_UTILITY_RUN_HANDLE_H
+#define	PYTHON_CPP_UTILITY_RUN_HANDLE_H
+
+#include "Run.h"
+
+#include <atomic>
+#include <future>
+#include <memory>
+
+namespace PythonCppUtility {
+
+    class Scheduler;
+
+    ///
+    /// The state shared between a cancellable run, the worker executing it and the handles used to cancel it
+    /// This type should not be used by the library's user and is only for internal housekeeping
+    /// This type is thread safe
+    ///
+    class RunControl {
+    public:
+
+        ///
+        /// Creates the control of a run that is about to be submitted
+        /// \param scheduler the scheduler the run is submitted to
+        /// \param run the run, which keeps a reference to the control
+        ///
+        RunControl(Scheduler &scheduler, Run *run);
+
+        ///
+        /// Cancels the run
+        /// A queued run is completed with RunCancelledError right away and removed from the scheduler's queue, or skipped by the worker that dequeues it if the queue does not support removal
+        /// A run that is executing is stopped before the script is evaluated, or interrupted by raising KeyboardInterrupt in the script if it is evaluated by the main interpreter. The run then fails with RunCancelledError
+        /// Scripts evaluated by a sub-interpreter or a worker process, and scripts blocked in native code, can not be interrupted
+        /// \return true if the run was or will be cancelled, false if it already finished or can not be interrupted
+        ///
+        bool cancel();
+
+        ///
+        /// Marks the run as started, called by the worker that dequeued it
+        /// If the run was cancelled, waits until the cancelling thread completed it
+        /// \return true if the run should be executed, false if it was cancelled and should only be destroyed
+        ///
+        bool start();
+
+        ///
+        /// Marks the start of the script's evaluation
+        /// Should only be called while the GIL is held
+        /// \param interruptible whether the script is evaluated by the calling thread and may be interrupted
+        /// \return true if the script should be evaluated, false if the run was cancelled
+        ///
+        bool enter_evaluation(bool interruptible);
+
+        ///
+        /// Marks the end of the script's evaluation and discards an interruption that was not raised before the script ended
+        /// Should only be called while the GIL is held
+        /// \return true if the script ran to it's end, false if the run was cancelled
+        ///
+        bool leave_evaluation();
+
+        ///
+        /// Marks the run as finished, called by the run before it completes it's future
+        /// Waits until no other thread is about to interrupt the run
+        ///
+        void finished();
+
+    private:
+
+        enum class State {
+            QUEUED,
+            STARTED,
+            EVALUATING,
+            FINISHED,
+            INTERRUPTED,
+            CANCELLING,
+            CANCELLED
+        };
+
+        Scheduler &scheduler_;
+        Run *run_;
+        std::atomic<State> state_;
+        std::atomic<std::size_t> interrupters_;
+        unsigned long thread_id_;
+        bool interruptible_;
+
+        bool interrupt();
+
+        RunControl(const RunControl &) = delete;
+        RunControl &operator=(const RunControl &) = delete;
+    };
+
+    ///
+    /// A handle to a submitted run, used to wait for it's result or to cancel it
+    /// The handle may outlive the run
+    ///
+    class RunHandle {
+    public:
+
+        ///
+        /// Creates a new handle
+        /// Should only be called by the script system
+        /// \param result the future of the run
+        /// \param control the control of the run
+        ///
+        RunHandle(std::future<bool> result, std::shared_ptr<RunControl> control);
+
+        RunHandle(RunHandle &&handle) = default;
+
+        RunHandle &operator=(RunHandle &&handle) = default;
+
+        ///
+        /// Cancels the run, see RunControl::cancel()
+        /// \return true if the run was or will be cancelled, false if it already finished or can not be interrupted
+        ///
+        bool cancel();
+
+        ///
+        /// \return the future of the run, which fails with RunCancelledError if the run was cancelled
+        ///
+        std::future<bool> &result();
+
+        ///
+        /// Blocks until the run finished
+        /// \return true if the script's run was successful
+        /// \throw RunCancelledError if the run was cancelled, or the error the run failed with
+        ///
+        bool get();
+
+    private:
+        std::future<bool> result_;
+        std::shared_ptr<RunControl> control_;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_RUN_HANDLE_H */
+
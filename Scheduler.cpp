@@ -5,8 +5,33 @@
 using namespace PythonCppUtility;
 using namespace std;
 
-Scheduler::Scheduler(std::size_t max_thread_count, bool start_after_init) : max_thread_count_(max_thread_count), threads_(), tasks_(), state_(Scheduler::State::STOPPED), mutex_(), condition_variable_(){
+namespace{
+    ///
+    /// The number of times an idle worker polls the lock free queue or the worker deques before parking
+    ///
+    const size_t spin_count = 64;
+
+    ///
+    /// The scheduler the calling thread is a worker of, or nullptr if none
+    ///
+    thread_local const Scheduler *current_scheduler = nullptr;
+
+    ///
+    /// The index of the calling worker thread in it's scheduler
+    ///
+    thread_local size_t current_worker_index = 0;
+}
+
+Scheduler::Scheduler(std::size_t max_thread_count, bool start_after_init, QueueType queue_type, size_t queue_capacity, MemoryPoolRef pool) : max_thread_count_(max_thread_count), threads_(), queue_type_(queue_type), ring_(queue_type == QueueType::LOCK_FREE ? queue_capacity : 1), queued_tasks_(Run::priority_count, QueuedTasks{less<QueueKey>{}, QueuedTasks::allocator_type{pool}}), next_sequence_(0), overflow_tasks_(), worker_queues_(), next_worker_queue_(0), state_(Scheduler::State::STOPPED), parked_workers_(0), overflow_count_(0), queued_count_(0), max_queue_depth_(0), overflow_policy_(OverflowPolicy::REJECT), block_timeout_(chrono::steady_clock::duration::zero()), blocked_submitters_(0), rejected_count_(0), dropped_count_(0), mutex_(), condition_variable_(), space_condition_variable_(), on_worker_start_(), on_worker_stop_(){
     assert(max_thread_count_ != 0);
+    for(atomic<size_t> &depth : queue_depths_){
+        depth = 0;
+    }
+    if(queue_type_ == QueueType::WORK_STEALING){
+        for(size_t i = 0; i < max_thread_count_; ++i){
+            worker_queues_.emplace_back(new WorkerQueue{});
+        }
+    }
     if(start_after_init){
         start();
     }
@@ -19,49 +44,178 @@ bool Scheduler::start(){
     }
     state_ = Scheduler::State::STARTED;
     for(size_t i = 0; i < max_thread_count_; ++i){
-        threads_.emplace_back([&](){
-            this->execute_tasks();
+        threads_.emplace_back([this, i](){
+            this->execute_tasks(i);
         });
     }
     return true;
 }
 
-void Scheduler::execute_tasks(){
+void Scheduler::execute_tasks(size_t worker_index){
+    current_scheduler = this;
+    current_worker_index = worker_index;
+    if(on_worker_start_){
+        on_worker_start_(worker_index);
+    }
     while(true){
-        Run *run = wait_for_next_task();
+        Run *run = wait_for_next_task(worker_index);
         if(run){
-            try{
-                run->operator ()();
-            }catch(...){
-                run->flag_error();
+            notify_space_available();
+            if(run->start()){
+                try{
+                    run->operator ()();
+                }catch(...){
+                    run->flag_error();
+                }
             }
-            delete run;
+            Run::destroy(run);
         }else{
-            return;
+            break;
         }
     }
+    if(on_worker_stop_){
+        on_worker_stop_(worker_index);
+    }
+    current_scheduler = nullptr;
 }
 
-Run *Scheduler::wait_for_next_task(){
+Run *Scheduler::wait_for_next_task(size_t worker_index){
+    if(queue_type_ == QueueType::LOCK_FREE){
+        return wait_for_next_ring_task();
+    }else if(queue_type_ == QueueType::WORK_STEALING){
+        return wait_for_next_stolen_task(worker_index);
+    }
     while(true){
         unique_lock<mutex> lock{mutex_};
         if(state_ != Scheduler::State::STARTED){
             return nullptr;
         }
-        if(tasks_.empty()){
-            condition_variable_.wait(lock);
-        }else{
-            Run *run = tasks_.front();
-            tasks_.pop_front();
+        // Highest priority class first, earliest deadline within the class
+        for(size_t i = Run::priority_count; i-- > 0;){
+            if(!queued_tasks_[i].empty()){
+                Run *run = queued_tasks_[i].begin()->second;
+                queued_tasks_[i].erase(queued_tasks_[i].begin());
+                return dequeued(run);
+            }
+        }
+        condition_variable_.wait(lock);
+    }
+}
+
+Run *Scheduler::dequeued(Run *task){
+    --queue_depths_[static_cast<size_t>(task->priority())];
+    --queued_count_;
+    return task;
+}
+
+Run *Scheduler::wait_for_next_ring_task(){
+    Run *run = nullptr;
+    size_t spins = 0;
+    while(true){
+        if(state_ != Scheduler::State::STARTED){
+            return nullptr;
+        }
+        if(ring_.try_pop(run)){
+            return dequeued(run);
+        }
+        if(overflow_count_ == 0 && spins < spin_count){
+            ++spins;
+            this_thread::yield();
+            continue;
+        }
+        unique_lock<mutex> lock{mutex_};
+        if(!overflow_tasks_.empty()){
+            run = overflow_tasks_.front();
+            overflow_tasks_.pop_front();
+            --overflow_count_;
+            return dequeued(run);
+        }
+        if(state_ != Scheduler::State::STARTED){
+            return nullptr;
+        }
+        // Announce the parked worker before checking the ring again, so a concurrent submit either sees the announcement or it's task is found here
+        ++parked_workers_;
+        atomic_thread_fence(memory_order_seq_cst);
+        if(ring_.try_pop(run)){
+            --parked_workers_;
+            return dequeued(run);
+        }
+        condition_variable_.wait(lock);
+        --parked_workers_;
+        spins = 0;
+    }
+}
+
+Run *Scheduler::wait_for_next_stolen_task(size_t worker_index){
+    size_t spins = 0;
+    while(true){
+        if(state_ != Scheduler::State::STARTED){
+            return nullptr;
+        }
+        Run *run = take_or_steal_task(worker_index);
+        if(run){
             return run;
         }
+        if(spins < spin_count){
+            ++spins;
+            this_thread::yield();
+            continue;
+        }
+        unique_lock<mutex> lock{mutex_};
+        if(state_ != Scheduler::State::STARTED){
+            return nullptr;
+        }
+        // Same protocol as for the lock free queue: announce the parked worker before looking at the deques again
+        ++parked_workers_;
+        atomic_thread_fence(memory_order_seq_cst);
+        run = take_or_steal_task(worker_index);
+        if(run){
+            --parked_workers_;
+            return run;
+        }
+        condition_variable_.wait(lock);
+        --parked_workers_;
+        spins = 0;
+    }
+}
+
+Run *Scheduler::take_or_steal_task(size_t worker_index){
+    {
+        WorkerQueue &own = *worker_queues_[worker_index];
+        lock_guard<mutex> lock{own.mutex};
+        if(!own.tasks.empty()){
+            Run *run = own.tasks.back();
+            own.tasks.pop_back();
+            return dequeued(run);
+        }
     }
+    for(size_t i = 1; i < worker_queues_.size(); ++i){
+        WorkerQueue &victim = *worker_queues_[(worker_index + i) % worker_queues_.size()];
+        lock_guard<mutex> lock{victim.mutex};
+        if(!victim.tasks.empty()){
+            Run *run = victim.tasks.front();
+            victim.tasks.pop_front();
+            return dequeued(run);
+        }
+    }
+    return nullptr;
 }
 
 bool Scheduler::submit(Run* task){
     assert(task);
+    if(!reserve_queue_slot()){
+        ++rejected_count_;
+        shed(task);
+        return false;
+    }
+    ++queue_depths_[static_cast<size_t>(task->priority())];
+    if(queue_type_ == QueueType::LOCK_FREE){
+        return submit_to_ring(task);
+    }else if(queue_type_ == QueueType::WORK_STEALING){
+        return submit_to_worker_queue(task);
+    }
     unique_lock<mutex> lock{mutex_};
-    tasks_.push_back(task);
+    queued_tasks_[static_cast<size_t>(task->priority())].insert(make_pair(make_pair(task->deadline(), next_sequence_++), task));
     if(state_ == Scheduler::State::STARTED){
         condition_variable_.notify_one();
         return true;
@@ -70,6 +224,157 @@ bool Scheduler::submit(Run* task){
     }
 }
 
+bool Scheduler::remove(Run *task){
+    if(queue_type_ != QueueType::LOCKED){
+        return false;
+    }
+    unique_lock<mutex> lock{mutex_};
+    QueuedTasks &queued_tasks = queued_tasks_[static_cast<size_t>(task->priority())];
+    for(QueuedTasks::iterator i = queued_tasks.lower_bound(make_pair(task->deadline(), uint64_t{0})); i != queued_tasks.end() && i->first.first == task->deadline(); ++i){
+        if(i->second == task){
+            queued_tasks.erase(i);
+            dequeued(task);
+            if(blocked_submitters_ != 0){
+                space_condition_variable_.notify_one();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::reserve_queue_slot(){
+    if(max_queue_depth_ == 0){
+        ++queued_count_;
+        return true;
+    }
+    chrono::steady_clock::time_point timeout = chrono::steady_clock::now() + block_timeout_;
+    while(true){
+        if(++queued_count_ <= max_queue_depth_){
+            return true;
+        }
+        --queued_count_;
+        if(overflow_policy_ == OverflowPolicy::REJECT){
+            return false;
+        }else if(overflow_policy_ == OverflowPolicy::DROP_OLDEST){
+            if(!drop_oldest_task()){
+                // The queued runs are being dequeued by the workers or the slots are reserved by submits that did not push their run yet
+                this_thread::yield();
+            }
+        }else{
+            unique_lock<mutex> lock{mutex_};
+            // Announce the blocked submitter before checking the depth, so a worker either sees the announcement or the room it made is seen here
+            ++blocked_submitters_;
+            auto has_room = [this](){
+                return queued_count_ < max_queue_depth_;
+            };
+            bool room = true;
+            if(block_timeout_ == chrono::steady_clock::duration::zero()){
+                space_condition_variable_.wait(lock, has_room);
+            }else{
+                room = space_condition_variable_.wait_until(lock, timeout, has_room);
+            }
+            --blocked_submitters_;
+            if(!room){
+                return false;
+            }
+        }
+    }
+}
+
+bool Scheduler::drop_oldest_task(){
+    Run *task = nullptr;
+    if(queue_type_ == QueueType::LOCK_FREE){
+        if(!ring_.try_pop(task)){
+            unique_lock<mutex> lock{mutex_};
+            if(!overflow_tasks_.empty()){
+                task = overflow_tasks_.front();
+                overflow_tasks_.pop_front();
+                --overflow_count_;
+            }
+        }
+    }else if(queue_type_ == QueueType::WORK_STEALING){
+        size_t first = next_worker_queue_;
+        for(size_t i = 0; i < worker_queues_.size() && !task; ++i){
+            WorkerQueue &queue = *worker_queues_[(first + i) % worker_queues_.size()];
+            lock_guard<mutex> lock{queue.mutex};
+            if(!queue.tasks.empty()){
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+        }
+    }else{
+        unique_lock<mutex> lock{mutex_};
+        for(QueuedTasks &queued_tasks : queued_tasks_){
+            if(!queued_tasks.empty()){
+                task = queued_tasks.begin()->second;
+                queued_tasks.erase(queued_tasks.begin());
+                break;
+            }
+        }
+    }
+    if(!task){
+        return false;
+    }
+    dequeued(task);
+    ++dropped_count_;
+    // The run is shed after the locks were released, a concurrent cancellation may have to remove it from the queue first
+    shed(task);
+    return true;
+}
+
+void Scheduler::shed(Run *task){
+    if(task->start()){
+        try{
+            throw QueueFullError{task->source()->id()};
+        }catch(...){
+            task->flag_error();
+        }
+    }
+    Run::destroy(task);
+}
+
+void Scheduler::notify_space_available(){
+    if(blocked_submitters_ != 0){
+        unique_lock<mutex> lock{mutex_};
+        space_condition_variable_.notify_one();
+    }
+}
+
+bool Scheduler::submit_to_ring(Run *task){
+    if(!ring_.try_push(task)){
+        unique_lock<mutex> lock{mutex_};
+        overflow_tasks_.push_back(task);
+        ++overflow_count_;
+    }
+    wake_parked_worker();
+    return state_ == Scheduler::State::STARTED;
+}
+
+bool Scheduler::submit_to_worker_queue(Run *task){
+    size_t worker_index;
+    if(current_scheduler == this){
+        worker_index = current_worker_index;
+    }else{
+        worker_index = next_worker_queue_++ % worker_queues_.size();
+    }
+    {
+        WorkerQueue &queue = *worker_queues_[worker_index];
+        lock_guard<mutex> lock{queue.mutex};
+        queue.tasks.push_back(task);
+    }
+    wake_parked_worker();
+    return state_ == Scheduler::State::STARTED;
+}
+
+void Scheduler::wake_parked_worker(){
+    atomic_thread_fence(memory_order_seq_cst);
+    if(parked_workers_ != 0){
+        unique_lock<mutex> lock{mutex_};
+        condition_variable_.notify_one();
+    }
+}
+
 bool Scheduler::stop(){
     {
         unique_lock<mutex> lock{mutex_};
@@ -89,16 +394,62 @@ bool Scheduler::stop(){
         unique_lock<mutex> lock{mutex_};
         state_ = Scheduler::State::STOPPED;
     }
+    return true;
 }
 
-Scheduler::State Scheduler::state() const{
+void Scheduler::queue_limit(size_t max_depth, OverflowPolicy policy, chrono::steady_clock::duration block_timeout){
+    max_queue_depth_ = max_depth;
+    overflow_policy_ = policy;
+    block_timeout_ = block_timeout;
+}
+
+void Scheduler::worker_callbacks(WorkerCallback on_start, WorkerCallback on_stop){
     unique_lock<mutex> lock{mutex_};
+    on_worker_start_ = on_start;
+    on_worker_stop_ = on_stop;
+}
+
+size_t Scheduler::max_thread_count() const{
+    return max_thread_count_;
+}
+
+Scheduler::QueueType Scheduler::queue_type() const{
+    return queue_type_;
+}
+
+size_t Scheduler::queue_depth(Run::Priority priority) const{
+    return queue_depths_[static_cast<size_t>(priority)];
+}
+
+size_t Scheduler::rejected_runs() const{
+    return rejected_count_;
+}
+
+size_t Scheduler::dropped_runs() const{
+    return dropped_count_;
+}
+
+Scheduler::State Scheduler::state() const{
     return state_;
 }
 
 Scheduler::~Scheduler(){
     stop();
-    for(Run *task : tasks_){
-        delete task;
+    Run *task = nullptr;
+    while(ring_.try_pop(task)){
+        Run::destroy(task);
+    }
+    for(auto &queued_tasks : queued_tasks_){
+        for(auto &queued_task : queued_tasks){
+            Run::destroy(queued_task.second);
+        }
+    }
+    for(Run *task : overflow_tasks_){
+        Run::destroy(task);
+    }
+    for(unique_ptr<WorkerQueue> &queue : worker_queues_){
+        for(Run *task : queue->tasks){
+            Run::destroy(task);
+        }
     }
 }
\ No newline at end of file
@@ -6,12 +6,21 @@
 #define	PYTHON_CPP_UTILITY_SCHEDULER_H
 
 #include "Run.h"
+#include "Queue.h"
 
+#include <atomic>
+#include <chrono>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
 #include <list>
+#include <map>
+#include <utility>
+#include <cstdint>
+#include <deque>
 #include <vector>
+#include <memory>
+#include <functional>
 
 namespace PythonCppUtility {
 
@@ -39,12 +48,68 @@ namespace PythonCppUtility {
             STOPPED
         };
 
+        ///
+        /// An enumeration type specifying the queue used to pass tasks to the worker threads
+        ///
+        enum class QueueType {
+            ///
+            /// An unbounded queue protected by a mutex, every submit and every worker serializes on the same lock
+            /// Runs are executed by priority class first and by deadline within a class, runs with the same deadline first in, first out
+            ///
+            LOCKED,
+            ///
+            /// A bounded lock free ring, idle workers spin briefly and then park on a condition variable until new tasks are submitted
+            /// Tasks submitted while the ring is full are kept in an overflow list protected by a mutex, which is drained whenever the ring runs empty
+            /// Priorities and deadlines are ignored, runs are executed roughly first in, first out
+            ///
+            LOCK_FREE,
+            ///
+            /// Each worker thread has it's own deque: tasks submitted by a worker thread, e.g. nested runs, are pushed onto it's own deque and executed last in, first out
+            /// Tasks submitted by other threads are distributed round robin over the deques, idle workers steal the oldest tasks from the other deques before parking
+            /// Priorities and deadlines are ignored
+            ///
+            WORK_STEALING
+        };
+
+        ///
+        /// An enumeration type specifying what happens to a run that is submitted while the queue is full
+        ///
+        enum class OverflowPolicy {
+            ///
+            /// The submitting thread blocks until a queued run is started, cancelled or dropped, or until the block timeout expires and the run is rejected
+            ///
+            BLOCK,
+            ///
+            /// The run is rejected right away, it's future fails with QueueFullError
+            ///
+            REJECT,
+            ///
+            /// The oldest queued run is dropped to make room, it's future fails with QueueFullError
+            /// For the locked queue the dropped run is the next run of the lowest non-empty priority class, the next run of the lock free queue or of one of the worker deques otherwise
+            ///
+            DROP_OLDEST
+        };
+
+        ///
+        /// The default capacity of the lock free queue
+        ///
+        static const std::size_t default_queue_capacity = 1024;
+
+        ///
+        /// The type of a callback that is executed by each worker thread when it starts or before it stops
+        /// \param worker_index the index of the worker thread, less than the maximum thread count
+        ///
+        using WorkerCallback = std::function<void (std::size_t worker_index)>;
+
         ///
         /// Creates a new scheduler
         /// \param max_thread_count the maximum number of threads used to execute scripts
         /// \param start if set to true, the scheduler will start before the constructor completes, otherwise it remains in the stopped state
+        /// \param queue_type the type of queue used to pass tasks to the worker threads
+        /// \param queue_capacity the capacity of the lock free queue, rounded up to the next power of two. Ignored for the locked queue
+        /// \param pool the pool to allocate the nodes of the locked queue from, or an empty reference to use the heap
         ///
-        Scheduler(std::size_t max_thread_count = 1, bool start = false);
+        Scheduler(std::size_t max_thread_count = 1, bool start = false, QueueType queue_type = QueueType::LOCKED, std::size_t queue_capacity = default_queue_capacity, MemoryPoolRef pool = MemoryPoolRef{});
 
         ///
         /// Move constructor
@@ -71,6 +136,15 @@ namespace PythonCppUtility {
         /// \return true if the scheduler is running, false otherwise
         bool submit(Run *task);
 
+        ///
+        /// Removes a run that was not yet started from the scheduler's queue
+        /// Only the locked queue supports removal, runs in the other queues stay queued until a worker dequeues them
+        /// This method is thread safe
+        /// \param task the queued run
+        /// \return true if the run was removed and the caller owns it, false if it was not found in the queue
+        ///
+        bool remove(Run *task);
+
         ///
         /// Stops the scheduler if it is started
         /// This method is thread safe and may block until all currently executing tasks are completed
@@ -79,9 +153,56 @@ namespace PythonCppUtility {
         ///
         bool stop();
 
+        ///
+        /// Limits the number of queued runs that were not yet started, by default the queue is unbounded
+        /// Should not be called concurrently with submit()
+        /// \param max_depth the maximum number of queued runs over all priority classes, or 0 for an unbounded queue
+        /// \param policy what happens to runs submitted while the queue is full
+        /// \param block_timeout the maximum time submit() blocks if the policy is OverflowPolicy::BLOCK, or zero to block until there is room
+        ///
+        void queue_limit(std::size_t max_depth, OverflowPolicy policy, std::chrono::steady_clock::duration block_timeout = std::chrono::steady_clock::duration::zero());
+
+        ///
+        /// Sets the callbacks executed by each worker thread when it starts or before it stops, e.g. to set up thread specific interpreter state
+        /// Should only be called while the scheduler is stopped
+        /// \param on_start the callback executed by each worker thread before it executes any task
+        /// \param on_stop the callback executed by each worker thread after it executed it's last task
+        ///
+        void worker_callbacks(WorkerCallback on_start, WorkerCallback on_stop);
+
+        ///
+        /// \return the maximum number of threads used to execute scripts
+        ///
+        std::size_t max_thread_count() const;
+
+        ///
+        /// \return the type of queue used to pass tasks to the worker threads
+        ///
+        QueueType queue_type() const;
+
+        ///
+        /// Returns the number of queued runs of a priority class that were not yet started
+        /// This method is thread safe
+        /// \param priority the priority class
+        /// \return the number of runs
+        ///
+        std::size_t queue_depth(Run::Priority priority) const;
+
+        ///
+        /// This method is thread safe
+        /// \return the number of runs that were rejected because the queue was full
+        ///
+        std::size_t rejected_runs() const;
+
+        ///
+        /// This method is thread safe
+        /// \return the number of queued runs that were dropped to make room for new runs
+        ///
+        std::size_t dropped_runs() const;
+
         ///
         /// Returns the current state of the scheduler
-        /// This method is thread safe and may block
+        /// This method is thread safe
         /// \return the scheduler's state
         ///
         State state() const;
@@ -93,16 +214,67 @@ namespace PythonCppUtility {
         ~Scheduler();
 
     private:
+
+        using QueueKey = std::pair<Run::Deadline, std::uint64_t>;
+
+        using QueuedTasks = std::map<QueueKey, Run *, std::less<QueueKey>, PoolAllocator<std::pair<const QueueKey, Run *>>>;
+
+        struct WorkerQueue {
+            std::mutex mutex;
+            std::deque<Run *> tasks;
+        };
+
         std::size_t max_thread_count_;
         std::vector<std::thread> threads_;
-        std::list<Run *> tasks_;
-        State state_;
+        QueueType queue_type_;
+        BoundedQueue<Run *> ring_;
+        std::vector<QueuedTasks> queued_tasks_;
+        std::uint64_t next_sequence_;
+        std::list<Run *> overflow_tasks_;
+        std::vector<std::unique_ptr<WorkerQueue>> worker_queues_;
+        std::atomic<std::size_t> next_worker_queue_;
+        std::atomic<State> state_;
+        std::atomic<std::size_t> parked_workers_;
+        std::atomic<std::size_t> overflow_count_;
+        std::atomic<std::size_t> queue_depths_[Run::priority_count];
+        std::atomic<std::size_t> queued_count_;
+        std::size_t max_queue_depth_;
+        OverflowPolicy overflow_policy_;
+        std::chrono::steady_clock::duration block_timeout_;
+        std::atomic<std::size_t> blocked_submitters_;
+        std::atomic<std::size_t> rejected_count_;
+        std::atomic<std::size_t> dropped_count_;
         mutable std::mutex mutex_;
         std::condition_variable condition_variable_;
+        std::condition_variable space_condition_variable_;
+        WorkerCallback on_worker_start_;
+        WorkerCallback on_worker_stop_;
+
+        void execute_tasks(std::size_t worker_index);
+
+        Run *wait_for_next_task(std::size_t worker_index);
+
+        Run *wait_for_next_ring_task();
+
+        Run *wait_for_next_stolen_task(std::size_t worker_index);
+
+        Run *take_or_steal_task(std::size_t worker_index);
+
+        Run *dequeued(Run *task);
+
+        bool reserve_queue_slot();
+
+        bool drop_oldest_task();
+
+        void notify_space_available();
+
+        static void shed(Run *task);
+
+        bool submit_to_ring(Run *task);
 
-        void execute_tasks();
+        bool submit_to_worker_queue(Run *task);
 
-        Run *wait_for_next_task();
+        void wake_parked_worker();
 
         Scheduler(const Scheduler &) = delete;
         Scheduler &operator=(const Scheduler &) = delete;
@@ -8,6 +8,7 @@
 
 #include "Source.h"
 #include "System.h"
+#include "Binding.h"
 
 #endif	/* PYTHON_CPP_UTILITY_SCRIPT_H */
 
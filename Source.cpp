@@ -1,41 +1,240 @@
 #include "Source.h"
+#include "SourceWatcher.h"
 
 #include <utility>
 #include <fstream>
 #include <sstream>
 #include <iterator>
+#include <algorithm>
+
+#if TARGET_OS_UNIX_LIKE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace PythonCppUtility;
 
 using namespace std;
 
-Source::Source(const Source::Id &id) : id_(id){}
+Source::Source(const Source::Id &id) : id_(id), compiled_code_mutex_(), compiled_code_(), code_version_(1), cache_hits_(), cache_misses_(), namespace_mutex_(), namespace_(), setup_code_(), namespace_version_(0), module_mutex_(), module_(), module_version_(1), latencies_(){}
 
 const Source::Id &Source::id() const{
     return id_;
 }
 
+boost::python::object Source::compiled_code(){
+    prepare();
+    size_t version = code_version_.load();
+    {
+        lock_guard<mutex> lock{compiled_code_mutex_};
+        if(!compiled_code_.empty(version)){
+            ++cache_hits_;
+            return compiled_code_.get(version);
+        }
+    }
+    ++cache_misses_;
+    // Compile without holding the lock: compilation may run arbitrary python code (e.g. the garbage collector) which can release the GIL
+    boost::python::object compiled = compile();
+    {
+        lock_guard<mutex> lock{compiled_code_mutex_};
+        if(code_version_.load() == version){
+            compiled_code_.set(compiled, version);
+        }
+    }
+    return compiled;
+}
+
+boost::python::object Source::module_namespace(){
+    using namespace boost::python;
+    size_t version;
+    string setup;
+    {
+        lock_guard<mutex> lock{namespace_mutex_};
+        version = namespace_version_;
+        if(!namespace_.empty(version)){
+            return namespace_.get(version);
+        }
+        setup = setup_code_;
+    }
+    // The setup code runs without holding the lock, it may release the GIL
+    object created = create_namespace(setup);
+    lock_guard<mutex> lock{namespace_mutex_};
+    if(namespace_version_ == version){
+        if(!namespace_.empty(version)){
+            return namespace_.get(version);
+        }
+        namespace_.set(created, version);
+    }
+    return created;
+}
+
+boost::python::object Source::module(){
+    using namespace boost::python;
+    size_t version = module_version_.load();
+    {
+        lock_guard<mutex> lock{module_mutex_};
+        if(!module_.empty(version)){
+            return module_.get(version);
+        }
+    }
+    // Like the setup code, the module's code runs without holding the lock
+    object created = create_namespace(setup_code());
+    handle<>{PyEval_EvalCode(compiled_code().ptr(), created.ptr(), created.ptr())};
+    lock_guard<mutex> lock{module_mutex_};
+    if(module_version_.load() == version){
+        if(!module_.empty(version)){
+            return module_.get(version);
+        }
+        module_.set(created, version);
+    }
+    return created;
+}
+
+boost::python::object Source::create_namespace(const string &setup){
+    using namespace boost::python;
+    dict created;
+    created["__builtins__"] = object{handle<>{borrowed(PyEval_GetBuiltins())}};
+    created["__name__"] = id_;
+    if(!setup.empty()){
+        string file_name = id_ + ":setup";
+        handle<> compiled{Py_CompileString(setup.c_str(), file_name.c_str(), Py_file_input)};
+        handle<>{PyEval_EvalCode(compiled.get(), created.ptr(), created.ptr())};
+    }
+    return created;
+}
+
+void Source::setup_code(const string &code){
+    lock_guard<mutex> lock{namespace_mutex_};
+    setup_code_ = code;
+    ++namespace_version_;
+    ++module_version_;
+}
+
+string Source::setup_code() const{
+    lock_guard<mutex> lock{namespace_mutex_};
+    return setup_code_;
+}
+
+void Source::prepare(){}
+
+boost::python::object Source::compile(){
+    using namespace boost::python;
+    str source_code = code();
+    const char *text = PyUnicode_AsUTF8(source_code.ptr());
+    if(!text){
+        throw_error_already_set();
+    }
+    return object{handle<>{Py_CompileString(text, id_.c_str(), Py_file_input)}};
+}
+
+void Source::invalidate_compiled_code(){
+    ++code_version_;
+    ++module_version_;
+}
+
+size_t Source::code_version() const{
+    return code_version_.load();
+}
+
+size_t Source::cache_hits() const{
+    return cache_hits_.load();
+}
+
+size_t Source::cache_misses() const{
+    return cache_misses_.load();
+}
+
+RunLatencies &Source::latencies(){
+    return latencies_;
+}
+
+const RunLatencies &Source::latencies() const{
+    return latencies_;
+}
+
 Source::~Source(){}
 
-BufferedSource::BufferedSource(const Source::Id &id) : Source(id), buffer_(){}
+BufferedSource::BufferedSource(const Source::Id &id) : Source(id), buffer_(), retain_buffer_(true), buffer_released_(false), code_object_mutex_(), code_object_(){}
 
-BufferedSource::BufferedSource(const Source::Id &id, const string &buffer) : Source(id), buffer_(buffer){}
+BufferedSource::BufferedSource(const Source::Id &id, const string &buffer) : Source(id), buffer_(buffer), retain_buffer_(true), buffer_released_(false), code_object_mutex_(), code_object_(){}
 
-BufferedSource::BufferedSource(const Source::Id &id, string &&buffer) : Source(id), buffer_(forward<string>(buffer)){};
+BufferedSource::BufferedSource(const Source::Id &id, string &&buffer) : Source(id), buffer_(forward<string>(buffer)), retain_buffer_(true), buffer_released_(false), code_object_mutex_(), code_object_(){};
 
 boost::python::str BufferedSource::code(){
-    return boost::python::str{buffer_};
+    using namespace boost::python;
+    while(true){
+        {
+            // The buffer may be replaced or released by another thread, it is only read under the lock and together with it's version
+            lock_guard<mutex> lock{code_object_mutex_};
+            size_t version = code_version();
+            if(!code_object_.empty(version)){
+                return extract<str>(code_object_.get(version));
+            }
+            if(!buffer_released_){
+                str code_object{buffer_};
+                code_object_.set(code_object, version);
+                if(!retain_buffer_){
+                    string{}.swap(buffer_);
+                    buffer_released_ = true;
+                }
+                return code_object;
+            }
+        }
+        // Restoring may read a file, which is done without holding the lock
+        restore_buffer();
+    }
+}
+
+void BufferedSource::retain_buffer(bool retain){
+    lock_guard<mutex> lock{code_object_mutex_};
+    retain_buffer_ = retain;
+}
+
+bool BufferedSource::retain_buffer() const{
+    lock_guard<mutex> lock{code_object_mutex_};
+    return retain_buffer_;
+}
+
+void BufferedSource::restore_buffer(){
+    throw BufferReleasedError{id()};
+}
+
+void BufferedSource::restore(string &&code){
+    lock_guard<mutex> lock{code_object_mutex_};
+    buffer_ = forward<string>(code);
+    buffer_released_ = false;
+}
+
+bool BufferedSource::replace_buffer(string &&code){
+    lock_guard<mutex> lock{code_object_mutex_};
+    if(!buffer_released_ && buffer_ == code){
+        return false;
+    }
+    buffer_ = forward<string>(code);
+    buffer_released_ = false;
+    // New runs miss the cache and compile the new buffer, running scripts keep their reference to the old code object
+    invalidate_compiled_code();
+    return true;
 }
 
 void BufferedSource::buffer(const string &code){
+    lock_guard<mutex> lock{code_object_mutex_};
     buffer_ = code;
+    buffer_released_ = false;
+    invalidate_compiled_code();
 }
 
 void BufferedSource::buffer(string &&code){
+    lock_guard<mutex> lock{code_object_mutex_};
     buffer_ = forward<string>(code);
+    buffer_released_ = false;
+    invalidate_compiled_code();
 }
 
-const string &BufferedSource::buffer() const{
+string BufferedSource::buffer() const{
+    lock_guard<mutex> lock{code_object_mutex_};
     return buffer_;
 }
 
@@ -54,9 +253,11 @@ const string &FileLoadError::path() const{
     return path_;
 }
 
+BufferReleasedError::BufferReleasedError(const Source::Id& id) : SourceError(id, string{"script buffer was released: "}+id){}
+
 AlreadyLoadedError::AlreadyLoadedError(const Source::Id& id) : SourceError(id, string{"script already loaded: "}+id){}
 
-FileSource::FileSource(const Source::Id &id, const string &path, bool defer_load) : BufferedSource(id), path_(path), loaded_(){
+FileSource::FileSource(const Source::Id &id, const string &path, bool defer_load, BytecodeCacheRef bytecode_cache) : BufferedSource(id), path_(path), loaded_(false), load_mutex_(), bytecode_cache_(bytecode_cache){
     if(!defer_load){
         load();
     }
@@ -64,37 +265,193 @@ FileSource::FileSource(const Source::Id &id, const string &path, bool defer_load
 
 FileSource::~FileSource(){}
 
-FileSource::FileSource(const string &path, bool defer_load) : FileSource(path,path, defer_load){}
+FileSource::FileSource(const string &path, bool defer_load, BytecodeCacheRef bytecode_cache) : FileSource(path,path, defer_load, bytecode_cache){}
 
 void FileSource::load(){
+    lock_guard<mutex> lock{load_mutex_};
     if(loaded_){
         throw AlreadyLoadedError{id()};
     }
+    buffer(read());
+    loaded_ = true;
+}
+
+bool FileSource::reload(){
+    if(!loaded_){
+        return false;
+    }
+    return replace_buffer(read());
+}
+
+string FileSource::read() const{
     ifstream input{path_.c_str()};
     if(input){
-        buffer(string{istreambuf_iterator<char>{input}, {}});
-        loaded_ = true;
+        return string{istreambuf_iterator<char>{input}, {}};
     }else{
         throw FileLoadError{id(), path_};
     }
 }
 
+void FileSource::prepare(){
+    if(!loaded_){
+        // Workers of different interpreters may prepare the source at the same time, only the first one loads it
+        lock_guard<mutex> lock{load_mutex_};
+        if(!loaded_){
+            buffer(read());
+            loaded_ = true;
+        }
+    }
+}
+
+boost::python::object FileSource::compile(){
+    if(!bytecode_cache_){
+        return BufferedSource::compile();
+    }
+    boost::python::str source_code = code();
+    boost::python::object compiled = bytecode_cache_->load(path_, source_code);
+    if(compiled.is_none()){
+        compiled = BufferedSource::compile();
+        bytecode_cache_->store(path_, source_code, compiled);
+    }
+    return compiled;
+}
+
+const string FileSource::path() const{
+    return path_;
+}
+
 bool FileSource::loaded() const{
     return loaded_;
 }
 
 boost::python::str FileSource::code(){
-    if(!loaded_){
+    prepare();
+    return BufferedSource::code();
+}
+
+void FileSource::restore_buffer(){
+    restore(read());
+}
+
+MappedFileSource::MappedFileSource(const Source::Id &id, const string &path, bool defer_load) : Source(id), path_(path), loaded_(false), load_mutex_(), data_(), size_(), mapped_size_(){
+    if(!defer_load){
         load();
     }
-    return boost::python::str{buffer()};
+}
+
+MappedFileSource::MappedFileSource(const string &path, bool defer_load) : MappedFileSource(path, path, defer_load){}
+
+#if TARGET_OS_UNIX_LIKE
+
+void MappedFileSource::map(){
+    int file = open(path_.c_str(), O_RDONLY);
+    if(file == -1){
+        throw FileLoadError{id(), path_};
+    }
+    struct stat file_stat;
+    if(fstat(file, &file_stat) != 0){
+        close(file);
+        throw FileLoadError{id(), path_};
+    }
+    size_t size = static_cast<size_t>(file_stat.st_size);
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    // Reserve at least one zeroed page past the end of the file, so the mapped code is always null terminated for the compiler
+    size_t mapped_size = (size / page_size + 1) * page_size;
+    void *data = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(data == MAP_FAILED){
+        close(file);
+        throw FileLoadError{id(), path_};
+    }
+    if(size != 0 && mmap(data, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, file, 0) == MAP_FAILED){
+        munmap(data, mapped_size);
+        close(file);
+        throw FileLoadError{id(), path_};
+    }
+    close(file);
+    data_ = static_cast<const char *>(data);
+    size_ = size;
+    mapped_size_ = mapped_size;
+    loaded_ = true;
+    invalidate_compiled_code();
+}
+
+MappedFileSource::~MappedFileSource(){
+    if(loaded_){
+        munmap(const_cast<char *>(data_), mapped_size_);
+    }
+}
+
+#else
+
+void MappedFileSource::map(){
+    // Memory mapping is only implemented for unix like systems, elsewhere the file is copied into a null terminated buffer
+    ifstream input{path_.c_str(), ios::binary};
+    if(!input){
+        throw FileLoadError{id(), path_};
+    }
+    string buffer{istreambuf_iterator<char>{input}, {}};
+    char *data = new char[buffer.size() + 1];
+    copy(buffer.begin(), buffer.end(), data);
+    data[buffer.size()] = '\0';
+    data_ = data;
+    size_ = buffer.size();
+    mapped_size_ = buffer.size() + 1;
+    loaded_ = true;
+    invalidate_compiled_code();
+}
+
+MappedFileSource::~MappedFileSource(){
+    delete[] data_;
+}
+
+#endif
+
+void MappedFileSource::load(){
+    lock_guard<mutex> lock{load_mutex_};
+    if(loaded_){
+        throw AlreadyLoadedError{id()};
+    }
+    map();
+}
+
+void MappedFileSource::prepare(){
+    if(!loaded_){
+        // Workers of different interpreters may prepare the source at the same time, only the first one maps the file
+        lock_guard<mutex> lock{load_mutex_};
+        if(!loaded_){
+            map();
+        }
+    }
+}
+
+boost::python::str MappedFileSource::code(){
+    using namespace boost::python;
+    prepare();
+    return str{handle<>{PyUnicode_DecodeUTF8(data_, static_cast<Py_ssize_t>(size_), nullptr)}};
+}
+
+boost::python::object MappedFileSource::compile(){
+    using namespace boost::python;
+    return object{handle<>{Py_CompileString(data_, id().c_str(), Py_file_input)}};
+}
+
+const string &MappedFileSource::path() const{
+    return path_;
+}
+
+bool MappedFileSource::loaded() const{
+    return loaded_;
 }
 
 DuplicateSourceError::DuplicateSourceError(const Source::Id& id) : SourceError(id, string{"duplicate source: "}+id){}
 
 NoSuchSourceError::NoSuchSourceError(const Source::Id& id) : SourceError(id, string{"unknown source: "}+id){}
 
-SourceManager::SourceManager() : sources_(){}
+SourceManager::SourceManager() : sources_(), bytecode_cache_(), retain_buffers_(true), shared_by_interpreters_(false), watcher_(){}
+
+SourceManager::SourceManager(bool shared_by_interpreters) : sources_(), bytecode_cache_(), retain_buffers_(true), shared_by_interpreters_(shared_by_interpreters), watcher_(){}
+
+SourceManager::~SourceManager(){}
 
 SourceRef SourceManager::create_source(const Source::Id& id, string&& buffer){
     return add_source(new BufferedSource{id, forward<string>(buffer)});
@@ -105,17 +462,50 @@ SourceRef SourceManager::create_source(const Source::Id &id, const string &buffe
 }
 
 SourceRef SourceManager::create_source_from_file(const Source::Id &id, const std::string &path, bool defer_load){
-    return add_source(new FileSource{id, path, defer_load});
+    return add_source(new FileSource{id, path, defer_load, bytecode_cache_});
 }
 
 SourceRef SourceManager::create_source_from_file(const std::string &path, bool defer_load){
-    return add_source(new FileSource{path, defer_load});
+    return add_source(new FileSource{path, defer_load, bytecode_cache_});
+}
+
+SourceRef SourceManager::create_source_from_mapped_file(const Source::Id &id, const string &path, bool defer_load){
+    return add_source(new MappedFileSource{id, path, defer_load});
+}
+
+SourceRef SourceManager::create_source_from_mapped_file(const string &path, bool defer_load){
+    return add_source(new MappedFileSource{path, defer_load});
+}
+
+void SourceManager::bytecode_cache(BytecodeCacheRef bytecode_cache){
+    bytecode_cache_ = bytecode_cache;
+}
+
+BytecodeCacheRef SourceManager::bytecode_cache() const{
+    return bytecode_cache_;
+}
+
+void SourceManager::retain_buffers(bool retain){
+    retain_buffers_ = retain;
+}
+
+bool SourceManager::retain_buffers() const{
+    return retain_buffers_;
 }
 
 bool SourceManager::has_source(const Source::Id &id) const{
     return sources_.find(id) != sources_.end();
 }
 
+vector<SourceRef> SourceManager::get_sources() const{
+    vector<SourceRef> sources;
+    sources.reserve(sources_.size());
+    for(const auto &source : sources_){
+        sources.push_back(source.second);
+    }
+    return sources;
+}
+
 SourceRef SourceManager::get_source(const Source::Id &id) const{
     auto found = sources_.find(id);
     if(found == sources_.end()){
@@ -130,6 +520,9 @@ SourceRef SourceManager::add_source(SourceRef source){
     if(has_source(id)){
         throw DuplicateSourceError{id};
     }else{
+        if(watcher_){
+            watcher_->watch(source);
+        }
         sources_.insert(make_pair(id, source));
         return source;
     }
@@ -140,6 +533,11 @@ SourceRef SourceManager::add_source(Source *source){
     return add_source(SourceRef{source});
 }
 
+SourceRef SourceManager::add_source(BufferedSource *source){
+    source->retain_buffer(retain_buffers_ || shared_by_interpreters_);
+    return add_source(static_cast<Source *>(source));
+}
+
 void SourceManager::remove_source(SourceRef source){
     return remove_source(source->id());
 }
@@ -149,6 +547,26 @@ void SourceManager::remove_source(const Source::Id &id){
     if(found == sources_.end()){
         throw NoSuchSourceError{id};
     }else{
+        if(watcher_){
+            watcher_->unwatch(found->second);
+        }
         sources_.erase(found);
     }
+}
+
+void SourceManager::watch_files(ReloadCallback on_reload){
+    unique_ptr<SourceWatcher> watcher{new SourceWatcher{move(on_reload)}};
+    for(const auto &source : sources_){
+        watcher->watch(source.second);
+    }
+    // The previous watcher is stopped after the new one watches all files, so no change is missed
+    watcher_.swap(watcher);
+}
+
+void SourceManager::unwatch_files(){
+    watcher_.reset();
+}
+
+bool SourceManager::watching_files() const{
+    return static_cast<bool>(watcher_);
 }
\ No newline at end of file
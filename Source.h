@@ -6,10 +6,18 @@
 #define	PYTHON_CPP_UTILITY_SOURCE_H
 
 #include "ScriptError.h"
+#include "CachedObject.h"
+#include "BytecodeCache.h"
+#include "Histogram.h"
 
 #include <string>
+#include <exception>
+#include <functional>
 #include <memory>
 #include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <atomic>
 
 #include <boost/python.hpp>
 
@@ -37,6 +45,68 @@ namespace PythonCppUtility {
         ///
         virtual boost::python::str code() = 0;
 
+        ///
+        /// Returns the compiled python code object for this source, compiling it on first use
+        /// The code object is cached until the source's code is invalidated
+        /// This method is thread safe but should only be called while the GIL is held
+        /// \throw boost::python::error_already_set if the source code could not be compiled
+        /// \return the compiled code object
+        ///
+        boost::python::object compiled_code();
+
+        ///
+        /// Returns the module namespace of this source, used as the global dictionary of all of it's runs while each run gets it's own local dictionary
+        /// The namespace is created on first use in each interpreter with the builtins, __name__ set to the source's ID and the objects defined by the setup code
+        /// If runs of the source start concurrently before the namespace was created, the setup code may be executed more than once but only one namespace is kept
+        /// This method is thread safe but should only be called while the GIL is held
+        /// \throw boost::python::error_already_set if the setup code could not be compiled or raised a python error
+        /// \return the namespace
+        ///
+        boost::python::object module_namespace();
+
+        ///
+        /// Sets the code that initialises the source's namespace, e.g. imports and constant tables that should be built once instead of in every run
+        /// Namespaces that were already created are discarded and created again with the new setup code on next use
+        /// This method is thread safe and does not require the GIL
+        /// \param code the python setup code, executed with the namespace as global and local dictionary
+        ///
+        void setup_code(const std::string &code);
+
+        ///
+        /// \return the code that initialises the source's namespace, empty if there is none
+        ///
+        std::string setup_code() const;
+
+        ///
+        /// Returns the source loaded as a module, i.e. a namespace like module_namespace() in which the source's code was executed once, so the functions it defines can be called directly
+        /// The module is loaded on first use in each interpreter and loaded again when the source's code or setup code changes
+        /// If functions of the source are called concurrently before the module was loaded, the code may be executed more than once but only one module is kept
+        /// This method is thread safe but should only be called while the GIL is held
+        /// \throw boost::python::error_already_set if the code could not be compiled or raised a python error
+        /// \return the module's dictionary
+        ///
+        boost::python::object module();
+
+        ///
+        /// \return the number of times compiled_code() was served from the cache
+        ///
+        std::size_t cache_hits() const;
+
+        ///
+        /// \return the number of times compiled_code() had to compile the source code
+        ///
+        std::size_t cache_misses() const;
+
+        ///
+        /// \return the latency histograms of the runs of this source, recorded by the runs
+        ///
+        RunLatencies &latencies();
+
+        ///
+        /// \return the latency histograms of the runs of this source
+        ///
+        const RunLatencies &latencies() const;
+
         ///
         /// \return the ID of this script, should be unique within the application
         ///
@@ -50,9 +120,54 @@ namespace PythonCppUtility {
         ///
         Source(const Id &id);
 
+        ///
+        /// Called by compiled_code() before the cache is consulted, allows sources to lazily load their code
+        /// Called with the GIL held
+        ///
+        virtual void prepare();
+
+        ///
+        /// Compiles the source code of this source
+        /// Called with the GIL held whenever compiled_code() misses the cache
+        /// \throw boost::python::error_already_set if the source code could not be compiled
+        /// \return the compiled code object
+        ///
+        virtual boost::python::object compile();
+
+        ///
+        /// Discards the cached code object, should be called whenever the source code changes
+        /// This method is thread safe and does not require the GIL
+        ///
+        void invalidate_compiled_code();
+
+        ///
+        /// \return a number that changes every time the compiled code is invalidated
+        ///
+        std::size_t code_version() const;
+
     private:
 
+        ///
+        /// Creates a new namespace with the builtins and __name__ and executes the setup code in it
+        /// \param setup the setup code, may be empty
+        /// \return the namespace
+        ///
+        boost::python::object create_namespace(const std::string &setup);
+
         Id id_;
+        std::mutex compiled_code_mutex_;
+        CachedObject compiled_code_;
+        std::atomic<std::size_t> code_version_;
+        std::atomic<std::size_t> cache_hits_;
+        std::atomic<std::size_t> cache_misses_;
+        mutable std::mutex namespace_mutex_;
+        CachedObject namespace_;
+        std::string setup_code_;
+        std::size_t namespace_version_;
+        std::mutex module_mutex_;
+        CachedObject module_;
+        std::atomic<std::size_t> module_version_;
+        RunLatencies latencies_;
 
         Source(const Source &) = delete;
         Source &operator=(const Source &) = delete;
@@ -80,9 +195,24 @@ namespace PythonCppUtility {
 
         ///
         /// see Source::code
+        /// The python string is created once and shared by all subsequent calls until the buffer changes
+        /// \throw BufferReleasedError if the buffer was released and the python string has to be recreated (e.g. after the interpreter was restarted)
         ///
         boost::python::str code();
 
+        ///
+        /// Sets whether the code buffer is kept in memory after the python string was created from it
+        /// Releasing the buffer roughly halves the memory used by the source, but the source can no longer be used after the interpreter is restarted unless it can restore the buffer itself
+        /// The buffer should be retained if the source is used by several sub-interpreters, each of them creates it's own python string from the buffer
+        /// \param retain if set to false, the buffer is released as soon as the python string was created
+        ///
+        void retain_buffer(bool retain);
+
+        ///
+        /// \return true if the code buffer is kept in memory after the python string was created, false otherwise
+        ///
+        bool retain_buffer() const;
+
         ///
         /// Destroys this source and deallocates the python code buffer
         ///
@@ -108,12 +238,38 @@ namespace PythonCppUtility {
         void buffer(std::string &&code);
 
         ///
-        /// \return a reference to the internal code buffer
+        /// \return a copy of the code buffer, the buffer itself may be replaced by another thread at any time
+        ///
+        std::string buffer() const;
+
+        ///
+        /// Called when the python string has to be recreated after the buffer was released
+        /// Should set the buffer again if possible
+        /// \throw BufferReleasedError if the buffer can not be restored
+        ///
+        virtual void restore_buffer();
+
+        ///
+        /// Replaces the code buffer while the source may be used by other threads
+        /// Runs that already fetched the compiled code finish with the old code, runs started afterwards compile and use the new code
+        /// This method is thread safe and does not require the GIL
+        /// \param code the new code
+        /// \return true if the code was replaced, false if it did not change
+        ///
+        bool replace_buffer(std::string &&code);
+
+        ///
+        /// Sets the released code buffer again without invalidating the compiled code, should only be used by restore_buffer()
+        /// \param code the code, which should be identical to the released code
         ///
-        const std::string &buffer() const;
+        void restore(std::string &&code);
 
     private:
         std::string buffer_;
+        bool retain_buffer_;
+        std::atomic<bool> buffer_released_;
+        mutable std::mutex code_object_mutex_;
+        CachedObject code_object_;
     };
 
     ///
@@ -160,6 +316,19 @@ namespace PythonCppUtility {
         std::string path_;
     };
 
+    ///
+    /// An error indicating that the source's code buffer was released and can not be restored
+    ///
+    class BufferReleasedError : public SourceError {
+    public:
+
+        ///
+        /// Creates a new error
+        /// \param id the unique ID of the script that caused the error
+        ///
+        BufferReleasedError(const Source::Id &id);
+    };
+
     ///
     /// An error indicating that the source was already loaded
     ///
@@ -183,15 +352,17 @@ namespace PythonCppUtility {
         /// \param id the unique id of the source
         /// \param path the system dependent path to the source file
         /// \param defer_load if set to true, the source code will be loaded in memory before the first useage, if set to false it will be loaded immediately
+        /// \param bytecode_cache an optional persistent cache for the compiled code
         ///
-        FileSource(const Id &id, const std::string &path, bool defer_load = false);
+        FileSource(const Id &id, const std::string &path, bool defer_load = false, BytecodeCacheRef bytecode_cache = BytecodeCacheRef{});
 
         ///
         /// Creates a new source from the specified file and an ID based on the path
         /// \param path the system dependent path to the source file
         /// \param defer_load if set to true, the source code will be loaded in memory before the first useage, if set to false it will be loaded immediately
+        /// \param bytecode_cache an optional persistent cache for the compiled code
         ///
-        FileSource(const std::string &path, bool defer_load = false);
+        FileSource(const std::string &path, bool defer_load = false, BytecodeCacheRef bytecode_cache = BytecodeCacheRef{});
 
         ///
         /// Destroys this source
@@ -215,13 +386,118 @@ namespace PythonCppUtility {
 
         ///
         /// Loads the souce code from the file
+        /// This method is thread safe, the file is read once even if several interpreters use a deferred source at the same time
         /// \throw AlreadyLoadedError if the source file was already loaded
         ///
         void load();
 
+        ///
+        /// Reads the file again and swaps the new code in if it changed, see BufferedSource::replace_buffer()
+        /// The file is read without holding any lock, so runs of the source are not paused. A source that was not loaded yet is left alone
+        /// This method is thread safe and does not require the GIL
+        /// \throw FileLoadError if the file could not be read, the source keeps it's code
+        /// \return true if the code changed, false otherwise
+        ///
+        bool reload();
+
+    protected:
+
+        ///
+        /// Loads the source code if it was deferred
+        ///
+        void prepare();
+
+        ///
+        /// Reloads the source code from the file
+        ///
+        void restore_buffer();
+
+        ///
+        /// Looks up the compiled code in the bytecode cache, compiling and storing it on a cache miss
+        ///
+        boost::python::object compile();
+
+    private:
+        std::string path_;
+        std::atomic<bool> loaded_;
+        std::mutex load_mutex_;
+        BytecodeCacheRef bytecode_cache_;
+
+        std::string read() const;
+    };
+
+    ///
+    /// An implementation of Source that maps it's python file read-only into memory instead of copying it into a buffer
+    /// The file is compiled directly from the mapped pages, so the page cache is shared between processes using the same scripts
+    /// The file should not be modified while it is mapped
+    ///
+    class MappedFileSource : public Source {
+    public:
+        ///
+        /// Creates a new source from the specified file
+        /// \param id the unique id of the source
+        /// \param path the system dependent path to the source file
+        /// \param defer_load if set to true, the file will be mapped before the first useage, if set to false it will be mapped immediately
+        ///
+        MappedFileSource(const Id &id, const std::string &path, bool defer_load = false);
+
+        ///
+        /// Creates a new source from the specified file and an ID based on the path
+        /// \param path the system dependent path to the source file
+        /// \param defer_load if set to true, the file will be mapped before the first useage, if set to false it will be mapped immediately
+        ///
+        MappedFileSource(const std::string &path, bool defer_load = false);
+
+        ///
+        /// Destroys this source and unmaps the file
+        ///
+        ~MappedFileSource();
+
+        ///
+        /// see Source::code()
+        /// Note that the python string is decoded from the mapped file on every call, scripts are compiled without it
+        ///
+        boost::python::str code();
+
+        ///
+        /// \return the system dependent path of the file that was/will be mapped
+        ///
+        const std::string &path() const;
+
+        ///
+        /// \return true if the file is currently mapped by this object, false otherwise
+        ///
+        bool loaded() const;
+
+        ///
+        /// Maps the file into memory
+        /// This method is thread safe, the file is mapped once even if several interpreters use a deferred source at the same time
+        /// \throw AlreadyLoadedError if the file was already mapped
+        /// \throw FileLoadError if the file could not be mapped
+        ///
+        void load();
+
+    protected:
+
+        ///
+        /// Maps the file if it was deferred
+        ///
+        void prepare();
+
+        ///
+        /// Compiles the mapped file without copying it
+        ///
+        boost::python::object compile();
+
     private:
         std::string path_;
-        bool loaded_;
+        std::atomic<bool> loaded_;
+        std::mutex load_mutex_;
+        const char *data_;
+        std::size_t size_;
+        std::size_t mapped_size_;
+
+        void map();
     };
 
     ///
@@ -254,6 +530,8 @@ namespace PythonCppUtility {
     ///
     using SourceRef = std::shared_ptr<Source>;
 
+    class SourceWatcher;
+
     ///
     /// This type can be used to create and keep track of sources
     /// The script's "user" can then keep a reference to the source to execute it later or use this type to do the lookups
@@ -262,11 +540,29 @@ namespace PythonCppUtility {
     class SourceManager{
     public:
 
+        ///
+        /// The type of the callback called by the file watcher's thread after a watched source was reloaded or failed to reload
+        /// \param source the source
+        /// \param error the error if the file could not be read, nullptr if the source was reloaded
+        ///
+        using ReloadCallback = std::function<void (SourceRef source, std::exception_ptr error)>;
+
         ///
         /// Creates a new source factory
         ///
         SourceManager();
 
+        ///
+        /// Creates a new source factory for sources that may be used by several interpreters at once
+        /// \param shared_by_interpreters if set to true, the sources keep their buffers regardless of retain_buffers(), since each interpreter creates it's own python string from the buffer
+        ///
+        explicit SourceManager(bool shared_by_interpreters);
+
+        ///
+        /// Stops watching files
+        ///
+        ~SourceManager();
+
         ///
         /// Creates a new source from the supplied buffer and adds it to the managed sources
         /// \param id the source's unique ID
@@ -300,6 +596,46 @@ namespace PythonCppUtility {
         ///
         SourceRef create_source_from_file(const std::string &path, bool defer_load = false);
 
+        ///
+        /// Creates a new source that maps the specified file into memory and adds it to the managed sources
+        /// \param id the source's unique ID
+        /// \param path a system dependent path to the python source
+        /// \param defer_load if set to true, the file will not be mapped until the source is actually used
+        /// \throw DuplicateSourceError if a source with this ID was already added to this manager
+        ///
+        SourceRef create_source_from_mapped_file(const Source::Id &id, const std::string &path, bool defer_load = false);
+
+        ///
+        /// Creates a new source that maps the specified file into memory and adds it to the managed sources
+        /// \param path a system dependent path to the python source
+        /// \param defer_load if set to true, the file will not be mapped until the source is actually used
+        /// \throw DuplicateSourceError if a source with this ID was already added to this manager
+        ///
+        SourceRef create_source_from_mapped_file(const std::string &path, bool defer_load = false);
+
+        ///
+        /// Sets the persistent bytecode cache used by all sources subsequently created from files
+        /// \param bytecode_cache the cache, or an empty reference to disable the bytecode cache
+        ///
+        void bytecode_cache(BytecodeCacheRef bytecode_cache);
+
+        ///
+        /// \return the persistent bytecode cache used by sources created from files, or an empty reference if none was set
+        ///
+        BytecodeCacheRef bytecode_cache() const;
+
+        ///
+        /// Sets whether sources subsequently created by this manager keep their code buffer after the python string was created
+        /// \param retain if set to false, new sources release their buffer, see BufferedSource::retain_buffer()
+        /// Ignored if the sources are shared by several interpreters, in which case they always keep their buffer
+        ///
+        void retain_buffers(bool retain);
+
+        ///
+        /// \return true if sources created by this manager keep their code buffer, false otherwise
+        ///
+        bool retain_buffers() const;
+
         ///
         /// Adds a source to the manager
         /// Sources can be added to multiple managers and each manager will keep track of it.
@@ -340,11 +676,45 @@ namespace PythonCppUtility {
         ///
         bool has_source(const Source::Id &id) const;
 
+        ///
+        /// \return references to all sources managed by this manager, in no particular order
+        ///
+        std::vector<SourceRef> get_sources() const;
+
+        ///
+        /// Starts watching the files of the managed file sources (see FileSource) and of file sources added later, reloading a source when it's file changes
+        /// Directories are watched instead of files, so files that editors replace by renaming are picked up too. Changes within a short period are reloaded once
+        /// Worker processes keep the code they were started with
+        /// Only supported on Linux, where the files are watched by inotify
+        /// \param on_reload an optional callback called by the watcher's thread after a source was reloaded or failed to reload
+        /// \throw SourceWatchError if the files can not be watched
+        ///
+        void watch_files(ReloadCallback on_reload = ReloadCallback{});
+
+        ///
+        /// Stops watching files, blocks until a reload in progress finished
+        ///
+        void unwatch_files();
+
+        ///
+        /// \return true if the files of the file sources are watched, false otherwise
+        ///
+        bool watching_files() const;
+
     private:
 
         SourceRef add_source(Source *source);
 
+        SourceRef add_source(BufferedSource *source);
+
         std::unordered_map<Source::Id, SourceRef> sources_;
+        BytecodeCacheRef bytecode_cache_;
+        bool retain_buffers_;
+        bool shared_by_interpreters_;
+        std::unique_ptr<SourceWatcher> watcher_;
+
+        SourceManager(const SourceManager &) = delete;
+        SourceManager &operator=(const SourceManager &) = delete;
     };
 
 }
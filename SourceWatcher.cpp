@@ -0,0 +1,178 @@
+#include "SourceWatcher.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace PythonCppUtility;
+using namespace std;
+
+namespace{
+    ///
+    /// Splits a path into the directory to watch and the file name reported by the directory's events
+    ///
+    pair<string, string> split_path(const string &path){
+        size_t separator = path.find_last_of('/');
+        if(separator == string::npos){
+            return make_pair(string{"."}, path);
+        }
+        return make_pair(separator == 0 ? string{"/"} : path.substr(0, separator), path.substr(separator + 1));
+    }
+}
+
+const chrono::milliseconds SourceWatcher::settle_time{50};
+
+#if defined(__linux__)
+
+SourceWatcher::SourceWatcher(SourceManager::ReloadCallback on_reload) : on_reload_(move(on_reload)), notify_descriptor_(-1), stop_descriptor_(-1), mutex_(), files_(), thread_(){
+    notify_descriptor_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(notify_descriptor_ == -1){
+        throw SourceWatchError{"unable to create the file watcher"};
+    }
+    stop_descriptor_ = eventfd(0, EFD_CLOEXEC);
+    if(stop_descriptor_ == -1){
+        close(notify_descriptor_);
+        throw SourceWatchError{"unable to create the file watcher"};
+    }
+    thread_ = std::thread{&SourceWatcher::run, this};
+}
+
+void SourceWatcher::watch(const SourceRef &source){
+    shared_ptr<FileSource> file_source = dynamic_pointer_cast<FileSource>(source);
+    if(!file_source){
+        return;
+    }
+    pair<string, string> path = split_path(file_source->path());
+    // Watching the directory also catches files that are replaced by renaming another file
+    int watch_descriptor = inotify_add_watch(notify_descriptor_, path.first.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if(watch_descriptor == -1){
+        throw SourceWatchError{"unable to watch the directory " + path.first + " of source " + source->id()};
+    }
+    lock_guard<mutex> lock{mutex_};
+    files_[watch_descriptor].push_back(WatchedFile{path.second, file_source});
+}
+
+void SourceWatcher::unwatch(const SourceRef &source){
+    lock_guard<mutex> lock{mutex_};
+    for(auto directory = files_.begin(); directory != files_.end();){
+        vector<WatchedFile> &files = directory->second;
+        files.erase(remove_if(files.begin(), files.end(), [&source](const WatchedFile &file){
+            return file.source.expired() || file.source.lock() == source;
+        }), files.end());
+        // The directory is no longer watched once none of it's files are, the kernel only keeps a limited number of watches
+        if(files.empty()){
+            inotify_rm_watch(notify_descriptor_, directory->first);
+            directory = files_.erase(directory);
+        }else{
+            ++directory;
+        }
+    }
+}
+
+void SourceWatcher::run(){
+    pollfd descriptors[2] = {pollfd{notify_descriptor_, POLLIN, 0}, pollfd{stop_descriptor_, POLLIN, 0}};
+    while(true){
+        if(poll(descriptors, 2, -1) == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            return;
+        }
+        if(descriptors[1].revents != 0){
+            return;
+        }
+        // Wait for the file to settle, stopping the watcher does not wait for it
+        if(poll(&descriptors[1], 1, static_cast<int>(settle_time.count())) > 0){
+            return;
+        }
+        for(const shared_ptr<FileSource> &source : changed_sources()){
+            reload(source);
+        }
+    }
+}
+
+vector<shared_ptr<FileSource>> SourceWatcher::changed_sources(){
+    vector<shared_ptr<FileSource>> changed;
+    auto add_changed = [&changed](const WatchedFile &file){
+        shared_ptr<FileSource> source = file.source.lock();
+        if(source && find(changed.begin(), changed.end(), source) == changed.end()){
+            changed.push_back(source);
+        }
+    };
+    alignas(inotify_event) char buffer[4096];
+    ssize_t length;
+    while((length = read(notify_descriptor_, buffer, sizeof(buffer))) > 0){
+        lock_guard<mutex> lock{mutex_};
+        for(char *position = buffer; position < buffer + length;){
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(position);
+            position += sizeof(inotify_event) + event->len;
+            if(event->mask & IN_Q_OVERFLOW){
+                // Events were lost, so any of the files may have changed. Reloading a source whose file did not change leaves it alone
+                for(const auto &directory : files_){
+                    for_each(directory.second.begin(), directory.second.end(), add_changed);
+                }
+                continue;
+            }
+            auto found = files_.find(event->wd);
+            if(event->len == 0 || found == files_.end()){
+                continue;
+            }
+            for(const WatchedFile &file : found->second){
+                if(file.name == event->name){
+                    add_changed(file);
+                }
+            }
+        }
+    }
+    return changed;
+}
+
+void SourceWatcher::reload(const shared_ptr<FileSource> &source){
+    exception_ptr error;
+    bool reloaded = false;
+    try{
+        reloaded = source->reload();
+    }catch(...){
+        error = current_exception();
+    }
+    if((reloaded || error) && on_reload_){
+        on_reload_(source, error);
+    }
+}
+
+SourceWatcher::~SourceWatcher(){
+    uint64_t stop = 1;
+    while(write(stop_descriptor_, &stop, sizeof(stop)) == -1 && errno == EINTR){
+    }
+    thread_.join();
+    close(stop_descriptor_);
+    close(notify_descriptor_);
+}
+
+#else
+
+SourceWatcher::SourceWatcher(SourceManager::ReloadCallback on_reload) : on_reload_(move(on_reload)), notify_descriptor_(-1), stop_descriptor_(-1), mutex_(), files_(), thread_(){
+    throw SourceWatchError{"watching files is only supported on linux"};
+}
+
+void SourceWatcher::watch(const SourceRef &){}
+
+void SourceWatcher::unwatch(const SourceRef &){}
+
+void SourceWatcher::run(){}
+
+vector<shared_ptr<FileSource>> SourceWatcher::changed_sources(){
+    return vector<shared_ptr<FileSource>>{};
+}
+
+void SourceWatcher::reload(const shared_ptr<FileSource> &){}
+
+SourceWatcher::~SourceWatcher(){}
+
+#endif
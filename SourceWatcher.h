@@ -0,0 +1,93 @@
+///
+/// Contains a watcher that reloads file sources when their files change
+///
+
+#ifndef PYTHON_CPP_UTILITY_SOURCE_WATCHER_H
+#define	PYTHON_CPP_UTILITY_SOURCE_WATCHER_H
+
+#include "Source.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace PythonCppUtility {
+
+    ///
+    /// An error that is thrown when files can not be watched
+    ///
+    class SourceWatchError : public ScriptError {
+    public:
+        using ScriptError::ScriptError;
+    };
+
+    ///
+    /// Watches the files of file sources in a thread of it's own and reloads a source when it's file was written or replaced, see FileSource::reload()
+    /// Used by the source manager, see SourceManager::watch_files()
+    /// This type is thread safe
+    ///
+    class SourceWatcher {
+    public:
+
+        ///
+        /// The time the watcher waits for further changes after a file changed, so a file written in several steps is reloaded once
+        ///
+        static const std::chrono::milliseconds settle_time;
+
+        ///
+        /// Creates a new watcher and starts it's thread
+        /// \param on_reload an optional callback called by the watcher's thread after a source was reloaded or failed to reload
+        /// \throw SourceWatchError if the platform does not support watching files or the watcher could not be created
+        ///
+        explicit SourceWatcher(SourceManager::ReloadCallback on_reload = SourceManager::ReloadCallback{});
+
+        ///
+        /// Starts watching the file of a source, sources that are not file sources are ignored
+        /// The watcher does not keep the source alive
+        /// \param source the source
+        /// \throw SourceWatchError if the file's directory can not be watched
+        ///
+        void watch(const SourceRef &source);
+
+        ///
+        /// Stops watching the file of a source
+        /// \param source the source
+        ///
+        void unwatch(const SourceRef &source);
+
+        ///
+        /// Stops the watcher's thread, blocks until a reload in progress finished
+        ///
+        ~SourceWatcher();
+
+    private:
+        struct WatchedFile {
+            std::string name;
+            std::weak_ptr<FileSource> source;
+        };
+
+        SourceManager::ReloadCallback on_reload_;
+        int notify_descriptor_;
+        int stop_descriptor_;
+        std::mutex mutex_;
+        std::unordered_map<int, std::vector<WatchedFile>> files_;
+        std::thread thread_;
+
+        void run();
+
+        std::vector<std::shared_ptr<FileSource>> changed_sources();
+
+        void reload(const std::shared_ptr<FileSource> &source);
+
+        SourceWatcher(const SourceWatcher &) = delete;
+        SourceWatcher &operator=(const SourceWatcher &) = delete;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_SOURCE_WATCHER_H */
+
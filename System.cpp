@@ -3,20 +3,45 @@
 using namespace PythonCppUtility;
 using namespace std;
 
-ScriptSystem::ScriptSystem(size_t worker_thread_count) : scheduler_(worker_thread_count, false), sources_(), modules_(), running_(){}
+ScriptSystem::ScriptSystem(size_t worker_thread_count, InterpreterMode interpreter_mode, Scheduler::QueueType queue_type) : main_thread_state_(), memory_pool_(make_shared<MemoryPool>()), scheduler_(worker_thread_count, false, queue_type, Scheduler::default_queue_capacity, memory_pool_), sources_(interpreter_mode == InterpreterMode::SUB_INTERPRETER_PER_WORKER && worker_thread_count > 1), modules_(), interpreter_mode_(interpreter_mode), own_gil_(false), interpreters_(), processes_(), running_(), watchdog_(), lifecycle_mutex_(){}
 
 bool ScriptSystem::start(){
+    // Keeps the source watcher from compiling while the interpreter is started
+    lock_guard<mutex> lock{lifecycle_mutex_};
     if(running_){
         return false;
     }else{
         running_ = true;
         modules_.import_modules();
 
+        // Worker processes have to be forked before the interpreter and the worker threads are started
+        if(interpreter_mode_ == InterpreterMode::PROCESS_PER_WORKER){
+            try{
+                start_worker_processes();
+            }catch(...){
+                running_ = false;
+                throw;
+            }
+        }
+
         Py_Initialize();
 
         //Acquiring interpreter lock and starting threading
         PyEval_InitThreads();
 
+        if(interpreter_mode_ == InterpreterMode::SUB_INTERPRETER_PER_WORKER){
+            try{
+                start_sub_interpreters();
+            }catch(...){
+                CachedObject::discard_all();
+                Py_Finalize();
+                running_ = false;
+                throw;
+            }
+        }else if(interpreter_mode_ == InterpreterMode::MAIN_INTERPRETER){
+            start_main_interpreter_threads();
+        }
+
         //Release interpreter lock
         main_thread_state_ = PyEval_SaveThread();
 
@@ -25,12 +50,87 @@ bool ScriptSystem::start(){
     }
 }
 
+void ScriptSystem::start_main_interpreter_threads(){
+    scheduler_.worker_callbacks([](size_t){
+        MainInterpreterThread::attach();
+        LocalsPool::open();
+    }, [](size_t){
+        {
+            GILGuard gil_guard{"LocalsPool::close"};
+            LocalsPool::close();
+        }
+        MainInterpreterThread::detach();
+    });
+}
+
+void ScriptSystem::start_sub_interpreters(){
+    try{
+        for(size_t i = 0; i < scheduler_.max_thread_count(); ++i){
+            interpreters_.emplace_back(new SubInterpreter{modules_, own_gil_});
+        }
+    }catch(...){
+        stop_sub_interpreters();
+        throw;
+    }
+    scheduler_.worker_callbacks([this](size_t worker_index){
+        interpreters_[worker_index]->attach();
+        LocalsPool::open();
+    }, [this](size_t worker_index){
+        {
+            GILGuard gil_guard{"LocalsPool::close"};
+            LocalsPool::close();
+        }
+        interpreters_[worker_index]->detach();
+    });
+}
+
+void ScriptSystem::start_worker_processes(){
+    try{
+        for(size_t i = 0; i < scheduler_.max_thread_count(); ++i){
+            processes_.emplace_back(new WorkerProcess{sources_});
+        }
+    }catch(...){
+        stop_worker_processes();
+        throw;
+    }
+    // The worker processes execute the scripts, but the workers still use the main interpreter for the local dictionaries
+    scheduler_.worker_callbacks([this](size_t worker_index){
+        processes_[worker_index]->attach();
+        MainInterpreterThread::attach();
+        LocalsPool::open();
+    }, [this](size_t worker_index){
+        {
+            GILGuard gil_guard{"LocalsPool::close"};
+            LocalsPool::close();
+        }
+        MainInterpreterThread::detach();
+        processes_[worker_index]->detach();
+    });
+}
+
+void ScriptSystem::stop_worker_processes(){
+    scheduler_.worker_callbacks(Scheduler::WorkerCallback{}, Scheduler::WorkerCallback{});
+    processes_.clear();
+}
+
+void ScriptSystem::stop_sub_interpreters(){
+    scheduler_.worker_callbacks(Scheduler::WorkerCallback{}, Scheduler::WorkerCallback{});
+    // Ending the interpreters in reverse order of creation
+    while(!interpreters_.empty()){
+        interpreters_.pop_back();
+    }
+}
+
 bool ScriptSystem::stop(){
+    lock_guard<mutex> lock{lifecycle_mutex_};
     if(running_){
         scheduler_.stop();
 
         // Swap main thread state back in: otherwise the thread state of the last executed thread is used and Py_Finalize segfaults
         PyEval_RestoreThread(main_thread_state_); 
+        stop_sub_interpreters();
+        stop_worker_processes();
+        CachedObject::discard_all();
         Py_Finalize();
         running_ = false;
         return true;
@@ -44,25 +144,123 @@ bool ScriptSystem::is_running() const{
 }
 
 future<bool> ScriptSystem::execute(SourceRef source, Run::BeforeCallback before, Run::AfterCallback after){
-    Run *run = new Run{source, before, after};
+    return execute(source, Run::Priority::NORMAL, Run::no_deadline(), move(before), move(after));
+}
+
+future<bool> ScriptSystem::execute(SourceRef source, Run::Priority priority, Run::Deadline deadline, Run::BeforeCallback before, Run::AfterCallback after){
+    return submit(Run::create<TypedRun<Run::BeforeCallback, Run::AfterCallback>>(memory_pool_, move(source), move(before), move(after), priority, deadline));
+}
+
+Completion ScriptSystem::submit_async(Run *run, Completion::Handler on_complete, Completion::Executor executor){
+    Completion completion{memory_pool_};
+    // The handler is attached before submitting, so it is called by the worker and not by this thread if the run finishes right away
+    Completion result = on_complete ? completion.then(move(on_complete), move(executor)) : completion;
+    run->completion(completion);
     scheduler_.submit(run);
-    return run->create_future();
+    return result;
+}
+
+future<bool> ScriptSystem::submit(Run *run){
+    // The future has to be created before submitting: a worker may finish and delete the run right away
+    future<bool> result = run->create_future();
+    scheduler_.submit(run);
+    return result;
+}
+
+RunHandle ScriptSystem::submit_cancellable(Run *run, chrono::steady_clock::duration timeout){
+    shared_ptr<RunControl> control = allocate_shared<RunControl>(PoolAllocator<RunControl>{memory_pool_}, scheduler_, run);
+    run->control(control);
+    future<bool> result = run->create_future();
+    if(timeout != chrono::steady_clock::duration::zero()){
+        watchdog_.watch(control, chrono::steady_clock::now() + timeout);
+    }
+    scheduler_.submit(run);
+    return RunHandle{move(result), move(control)};
 }
 
 bool ScriptSystem::execute_and_wait(SourceRef source, Run::BeforeCallback before, Run::AfterCallback after) {
-    return execute(source, before, after).get();
+    return execute(source, move(before), move(after)).get();
 }
 
 
 future<bool> ScriptSystem::execute(const Source::Id &id, Run::BeforeCallback before, Run::AfterCallback after){
-    return execute(sources_.get_source(id), before, after);
+    return execute(sources_.get_source(id), move(before), move(after));
 }
 
 bool ScriptSystem::execute_and_wait(const Source::Id &id, Run::BeforeCallback before, Run::AfterCallback after) {
-    return execute_and_wait(sources_.get_source(id), before, after);
+    return execute_and_wait(sources_.get_source(id), move(before), move(after));
 }
 
+future<bool> ScriptSystem::execute(SourceRef source, Run::Deadline deadline, Run::BeforeCallback before, Run::AfterCallback after){
+    return execute(source, Run::Priority::NORMAL, deadline, move(before), move(after));
+}
 
+future<bool> ScriptSystem::execute(const Source::Id &id, Run::Priority priority, Run::Deadline deadline, Run::BeforeCallback before, Run::AfterCallback after){
+    return execute(sources_.get_source(id), priority, deadline, move(before), move(after));
+}
+
+future<bool> ScriptSystem::execute(const Source::Id &id, Run::Deadline deadline, Run::BeforeCallback before, Run::AfterCallback after){
+    return execute(sources_.get_source(id), Run::Priority::NORMAL, deadline, move(before), move(after));
+}
+
+
+
+future<bool> ScriptSystem::execute_batch(SourceRef source, vector<BatchRun::Item> items, chrono::microseconds time_slice){
+    return submit(Run::create<BatchRun>(memory_pool_, move(source), move(items), time_slice, Run::Priority::NORMAL, Run::no_deadline()));
+}
+
+future<bool> ScriptSystem::execute_batch(const Source::Id &id, vector<BatchRun::Item> items, chrono::microseconds time_slice){
+    return execute_batch(sources_.get_source(id), move(items), time_slice);
+}
+
+vector<future<bool>> ScriptSystem::execute_batch_items(SourceRef source, vector<BatchRun::Item> items, chrono::microseconds time_slice){
+    BatchRun *run = Run::create<BatchRun>(memory_pool_, move(source), move(items), time_slice, Run::Priority::NORMAL, Run::no_deadline());
+    vector<future<bool>> results = run->create_item_futures();
+    scheduler_.submit(run);
+    return results;
+}
+
+vector<future<bool>> ScriptSystem::execute_batch_items(const Source::Id &id, vector<BatchRun::Item> items, chrono::microseconds time_slice){
+    return execute_batch_items(sources_.get_source(id), move(items), time_slice);
+}
+
+void ScriptSystem::queue_limit(size_t max_depth, Scheduler::OverflowPolicy policy, chrono::steady_clock::duration block_timeout){
+    scheduler_.queue_limit(max_depth, policy, block_timeout);
+}
+
+void ScriptSystem::own_gil(bool own_gil){
+    lock_guard<mutex> lock{lifecycle_mutex_};
+    own_gil_ = own_gil;
+}
+
+bool ScriptSystem::own_gil() const{
+    return own_gil_;
+}
+
+void ScriptSystem::watch_sources(SourceManager::ReloadCallback on_reload){
+    sources_.watch_files([this, on_reload](SourceRef source, exception_ptr error){
+        if(!error){
+            lock_guard<mutex> lock{lifecycle_mutex_};
+            // Sub-interpreters and worker processes compile in their own interpreter, only the main interpreter's cache can be filled from here
+            if(running_ && interpreter_mode_ == InterpreterMode::MAIN_INTERPRETER){
+                GILGuard gil_guard{"ScriptSystem::watch_sources"};
+                try{
+                    source->compiled_code();
+                }catch(boost::python::error_already_set &){
+                    // The runs of the source report the error
+                    PyErr_Clear();
+                }
+            }
+        }
+        if(on_reload){
+            on_reload(source, error);
+        }
+    });
+}
+
+void ScriptSystem::unwatch_sources(){
+    sources_.unwatch_files();
+}
 
 SourceManager &ScriptSystem::sources(){
     return sources_;
@@ -80,6 +278,28 @@ const ModuleManager &ScriptSystem::modules() const{
     return modules_;
 }
 
+ScriptSystem::InterpreterMode ScriptSystem::interpreter_mode() const{
+    return interpreter_mode_;
+}
+
+size_t ScriptSystem::queue_depth(Run::Priority priority) const{
+    return scheduler_.queue_depth(priority);
+}
+
+ScriptSystem::Stats ScriptSystem::stats() const{
+    size_t queued_runs = 0;
+    for(size_t i = 0; i < Run::priority_count; ++i){
+        queued_runs += scheduler_.queue_depth(static_cast<Run::Priority>(i));
+    }
+    Stats stats{memory_pool_->heap_allocations(), queued_runs, scheduler_.rejected_runs(), scheduler_.dropped_runs(), {}};
+    for(const SourceRef &source : sources_.get_sources()){
+        stats.latencies.insert(make_pair(source->id(), RunLatencySnapshot::of(source->latencies())));
+    }
+    return stats;
+}
+
 ScriptSystem::~ScriptSystem(){
+    // The watcher's callback uses the system, it has to be stopped before the system is destroyed
+    sources_.unwatch_files();
     stop();
 }
\ No newline at end of file
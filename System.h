@@ -8,10 +8,24 @@
 #include "Run.h"
 #include "Scheduler.h"
 #include "Module.h"
+#include "Interpreter.h"
+#include "Process.h"
+#include "MemoryPool.h"
+#include "Completion.h"
+#include "Awaitable.h"
+#include "RunHandle.h"
+#include "Watchdog.h"
+#include "GILProfiler.h"
+#include "SourceWatcher.h"
 
 #include <memory>
 #include <functional>
 #include <future>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include <type_traits>
 
 #include <boost/python.hpp>
 
@@ -36,15 +50,76 @@ namespace PythonCppUtility {
     class ScriptSystem {
     public:
 
+        ///
+        /// An enumeration type specifying how the worker threads use the python interpreter
+        ///
+        enum class InterpreterMode {
+            ///
+            /// All worker threads run their scripts in the main interpreter, serialized by a single GIL
+            ///
+            MAIN_INTERPRETER,
+            ///
+            /// Each worker thread runs it's scripts in it's own sub-interpreter, the modules are initialized in each of them
+            /// By default and always before python 3.12 the sub-interpreters share a single GIL, so scripts do not run in parallel
+            /// From python 3.12 on each sub-interpreter can have it's own GIL so scripts run in parallel, see own_gil(bool)
+            /// Note that python objects can not be shared between scripts running in different workers
+            /// With more than one worker the sources always keep their code buffer, see SourceManager::retain_buffers(bool)
+            ///
+            SUB_INTERPRETER_PER_WORKER,
+            ///
+            /// Each worker thread ships it's scripts to it's own forked worker process, which runs them in a separate interpreter
+            /// The callbacks still run in the main interpreter: the local dictionary is pickled before the script runs and the picklable part of the result is copied back
+            /// Worker processes only know the sources and modules that were added before start() was called, see WorkerProcess
+            ///
+            PROCESS_PER_WORKER
+        };
+
+        ///
+        /// A snapshot of the script system's counters
+        ///
+        struct Stats {
+            ///
+            /// The number of memory blocks the script system's run pool had to allocate from the heap, stops growing once the pool has warmed up
+            /// Allocations made by the callbacks, by the python interpreter and for the inputs of batch runs are not counted
+            ///
+            std::size_t heap_allocations;
+
+            ///
+            /// The number of queued runs that were not yet started, over all priority classes
+            ///
+            std::size_t queued_runs;
+
+            ///
+            /// The number of runs that were rejected because the scheduler's queue was full
+            ///
+            std::size_t rejected_runs;
+
+            ///
+            /// The number of queued runs that were dropped to make room for new runs
+            ///
+            std::size_t dropped_runs;
+
+            ///
+            /// The latency histograms of the runs of each source managed by the source manager, by source ID
+            ///
+            std::unordered_map<Source::Id, RunLatencySnapshot> latencies;
+        };
+
         ///
         /// Creates an instance of a script system
         /// This does not start the python interpreter
-        /// \param worker_thread_count the amount of worker threads. Due to CPythons interpreter lock, using many threads will not lead to significant improvement
+        /// \param worker_thread_count the amount of worker threads. Due to CPythons interpreter lock, using many threads will not lead to significant improvement unless each worker has it's own sub-interpreter
+        /// \param interpreter_mode specifies whether the worker threads share the main interpreter or each use their own sub-interpreter
+        /// \param queue_type the type of queue used by the scheduler to pass scripts to the worker threads. The lock free queue reduces contention when many threads submit scripts
         ///
-        ScriptSystem(std::size_t worker_thread_count = 1);
+        ScriptSystem(std::size_t worker_thread_count = 1, InterpreterMode interpreter_mode = InterpreterMode::MAIN_INTERPRETER, Scheduler::QueueType queue_type = Scheduler::QueueType::LOCKED);
 
         ///
         /// Starts the python interpreter after initializing the modules added to the system's module manager
+        /// \throw InterpreterError if the sub-interpreters could not be created
+        /// \throw SingleInterpreterModuleError if the sub-interpreters have their own GIL and a module is not multi interpreter safe
+        /// \throw ModuleImportError if a module could not be imported in a sub-interpreter
+        /// \throw WorkerProcessError if the worker processes could not be started
         ///
         bool start();
 
@@ -82,6 +157,245 @@ namespace PythonCppUtility {
         std::future<bool> execute(const Source::Id &source_id, Run::BeforeCallback before = Run::BeforeCallback{[](boost::python::object) {}}, Run::AfterCallback after = Run::AfterCallback{[](boost::python::object) {}});
 
 
+        ///
+        /// Schedules a script to run from the specified source. Does not block until the script finishes
+        /// Unlike the overloads taking Run::BeforeCallback and Run::AfterCallback, the callbacks are stored by their own type and called directly, e.g. lambdas are neither wrapped in a std::function nor copied to the heap
+        /// The caller is responsible for concurrency and consistency of the data used in the callback functions at the moment of execution
+        /// \tparam Before the type of the before callback, callable with the local dictionary as boost::python::object
+        /// \tparam After the type of the after callback, callable with the local dictionary as boost::python::object
+        /// \param source a reference to the script's source
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs. Should be used to put objects into python's local dictionary for the script to use as arguments
+        /// \param after a callback to be executed after the script runs but before the GIL is released. Should be used to put objects to get the results of thes script out of python's local dictionary.
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a future that returns "true" when the script and the after callback has finished executing, will propagate a ScriptError if the script raises a python error or either callback function throws an exception
+        ///
+        template<typename Before, typename After = Run::NoCallback, typename std::enable_if<IsRunCallback<Before>::value && IsRunCallback<After>::value, int>::type = 0> std::future<bool> execute(SourceRef source, Before before, After after = After{}){
+            return submit(Run::create<TypedRun<Before, After>>(memory_pool_, std::move(source), std::move(before), std::move(after), Run::Priority::NORMAL, Run::no_deadline()));
+        }
+
+        ///
+        /// Schedules a script to run from the specified source with a priority class and deadline. Does not block until the script finishes
+        /// See execute(SourceRef, Before, After) and execute(SourceRef, Run::Priority, Run::Deadline, Run::BeforeCallback, Run::AfterCallback)
+        /// \tparam Before the type of the before callback, callable with the local dictionary as boost::python::object
+        /// \tparam After the type of the after callback, callable with the local dictionary as boost::python::object
+        /// \param source a reference to the script's source
+        /// \param priority the priority class of the script run
+        /// \param deadline the point in time the script should be started by
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs
+        /// \param after a callback to be executed after the script runs but before the GIL is released
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a future that returns "true" when the script and the after callback has finished executing, will propagate a ScriptError if the script raises a python error or either callback function throws an exception
+        ///
+        template<typename Before, typename After = Run::NoCallback, typename std::enable_if<IsRunCallback<Before>::value && IsRunCallback<After>::value, int>::type = 0> std::future<bool> execute(SourceRef source, Run::Priority priority, Run::Deadline deadline, Before before, After after = After{}){
+            return submit(Run::create<TypedRun<Before, After>>(memory_pool_, std::move(source), std::move(before), std::move(after), priority, deadline));
+        }
+
+        ///
+        /// Schedules a script to run from the specified source. Does not block until the script finishes
+        /// See execute(SourceRef, Before, After)
+        /// \tparam Before the type of the before callback, callable with the local dictionary as boost::python::object
+        /// \tparam After the type of the after callback, callable with the local dictionary as boost::python::object
+        /// \param source_id the ID of this script's source
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs
+        /// \param after a callback to be executed after the script runs but before the GIL is released
+        /// \throw NoSuchSourceError if no source with the specified ID was registered
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a future that returns "true" when the script and the after callback has finished executing, will propagate a ScriptError if the script raises a python error or either callback function throws an exception
+        ///
+        template<typename Before, typename After = Run::NoCallback, typename std::enable_if<IsRunCallback<Before>::value && IsRunCallback<After>::value, int>::type = 0> std::future<bool> execute(const Source::Id &source_id, Before before, After after = After{}){
+            return execute(sources_.get_source(source_id), std::move(before), std::move(after));
+        }
+
+        ///
+        /// Schedules a script to run from the specified source without a future. Does not block until the script finishes
+        /// Instead of waiting for a future, the caller is notified by the completion handler or by continuations attached to the returned completion
+        /// The caller is responsible for concurrency and consistency of the data used in the callback functions at the moment of execution
+        /// \tparam Before the type of the before callback, callable with the local dictionary as boost::python::object
+        /// \tparam After the type of the after callback, callable with the local dictionary as boost::python::object
+        /// \param source a reference to the script's source
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs. Should be used to put objects into python's local dictionary for the script to use as arguments
+        /// \param after a callback to be executed after the script runs but before the GIL is released. Should be used to put objects to get the results of thes script out of python's local dictionary.
+        /// \param on_complete a handler called after the GIL was released with the error of the run, or nullptr if the script and the after callback finished executing. An empty function if no handler should be called
+        /// \param executor the executor to call the completion handler with, or an empty function to call it in the worker thread that executed the script
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return the completion of the completion handler, or of the run itself if no handler was given. More continuations can be attached with Completion::then()
+        ///
+        template<typename Before, typename After, typename std::enable_if<IsRunCallback<Before>::value && IsRunCallback<After>::value, int>::type = 0> Completion execute_async(SourceRef source, Before before, After after, Completion::Handler on_complete = Completion::Handler{}, Completion::Executor executor = Completion::Executor{}){
+            return submit_async(Run::create<TypedRun<Before, After>>(memory_pool_, std::move(source), std::move(before), std::move(after), Run::Priority::NORMAL, Run::no_deadline()), std::move(on_complete), std::move(executor));
+        }
+
+        ///
+        /// Schedules a script to run from the specified source without a future. Does not block until the script finishes
+        /// See execute_async(SourceRef, Before, After, Completion::Handler, Completion::Executor)
+        /// \tparam Before the type of the before callback, callable with the local dictionary as boost::python::object
+        /// \tparam After the type of the after callback, callable with the local dictionary as boost::python::object
+        /// \param source_id the ID of this script's source
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs
+        /// \param after a callback to be executed after the script runs but before the GIL is released
+        /// \param on_complete a handler called after the GIL was released with the error of the run, or nullptr if it succeeded. An empty function if no handler should be called
+        /// \param executor the executor to call the completion handler with, or an empty function to call it in the worker thread that executed the script
+        /// \throw NoSuchSourceError if no source with the specified ID was registered
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return the completion of the completion handler, or of the run itself if no handler was given
+        ///
+        template<typename Before, typename After, typename std::enable_if<IsRunCallback<Before>::value && IsRunCallback<After>::value, int>::type = 0> Completion execute_async(const Source::Id &source_id, Before before, After after, Completion::Handler on_complete = Completion::Handler{}, Completion::Executor executor = Completion::Executor{}){
+            return execute_async(sources_.get_source(source_id), std::move(before), std::move(after), std::move(on_complete), std::move(executor));
+        }
+
+        ///
+        /// Schedules a script to run from the specified source that can be cancelled. Does not block until the script finishes
+        /// A queued run is cancelled right away, a run that is executing is interrupted if it is evaluated by the main interpreter, see RunControl::cancel()
+        /// The caller is responsible for concurrency and consistency of the data used in the callback functions at the moment of execution
+        /// \tparam Before the type of the before callback, callable with the local dictionary as boost::python::object
+        /// \tparam After the type of the after callback, callable with the local dictionary as boost::python::object
+        /// \param source a reference to the script's source
+        /// \param timeout the time after which the run is cancelled if it did not finish, measured from the submission. Zero if the run should only be cancelled by the handle
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs. Should be used to put objects into python's local dictionary for the script to use as arguments
+        /// \param after a callback to be executed after the script runs but before the GIL is released. Should be used to put objects to get the results of thes script out of python's local dictionary.
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a handle to wait for the run or cancel it, the run's future fails with RunCancelledError if it was cancelled
+        ///
+        template<typename Before, typename After = Run::NoCallback, typename std::enable_if<IsRunCallback<Before>::value && IsRunCallback<After>::value, int>::type = 0> RunHandle execute_cancellable(SourceRef source, std::chrono::steady_clock::duration timeout, Before before, After after = After{}){
+            return submit_cancellable(Run::create<TypedRun<Before, After>>(memory_pool_, std::move(source), std::move(before), std::move(after), Run::Priority::NORMAL, Run::no_deadline()), timeout);
+        }
+
+        ///
+        /// Schedules a script to run from the specified source that can be cancelled. Does not block until the script finishes
+        /// See execute_cancellable(SourceRef, std::chrono::steady_clock::duration, Before, After)
+        /// \tparam Before the type of the before callback, callable with the local dictionary as boost::python::object
+        /// \tparam After the type of the after callback, callable with the local dictionary as boost::python::object
+        /// \param source_id the ID of this script's source
+        /// \param timeout the time after which the run is cancelled if it did not finish, measured from the submission. Zero if the run should only be cancelled by the handle
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs
+        /// \param after a callback to be executed after the script runs but before the GIL is released
+        /// \throw NoSuchSourceError if no source with the specified ID was registered
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a handle to wait for the run or cancel it
+        ///
+        template<typename Before, typename After = Run::NoCallback, typename std::enable_if<IsRunCallback<Before>::value && IsRunCallback<After>::value, int>::type = 0> RunHandle execute_cancellable(const Source::Id &source_id, std::chrono::steady_clock::duration timeout, Before before, After after = After{}){
+            return execute_cancellable(sources_.get_source(source_id), timeout, std::move(before), std::move(after));
+        }
+
+        ///
+        /// Schedules a call of a function defined by the specified source. Does not block until the function returns
+        /// The source is loaded as a module once per interpreter, see Source::module(), and each run is a single call of the function without a local dictionary and without executing the source's code again
+        /// Not supported if scripts are executed in worker processes, the run fails with a SourceError
+        /// \tparam After the type of the after callback, callable with the function's result as boost::python::object
+        /// \tparam Arguments the types of the function's positional arguments, each convertible by boost::python::object's constructor
+        /// \param source a reference to the script's source
+        /// \param function the name of the function to call
+        /// \param after a callback to be executed with the function's result before the GIL is released, Run::NoCallback if the result is not needed
+        /// \param arguments the function's positional arguments, they are copied and converted to python objects by the worker thread
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a future that returns 'true' if the function returned, or rethrows the error if the function is not defined or raised a python error
+        ///
+        template<typename After, typename... Arguments, typename std::enable_if<IsRunCallback<After>::value, int>::type = 0> std::future<bool> execute_function(SourceRef source, const std::string &function, After after, Arguments... arguments){
+            return submit(Run::create<FunctionRun<After, Arguments...>>(memory_pool_, std::move(source), function, std::move(after), std::make_tuple(std::move(arguments)...), Run::Priority::NORMAL, Run::no_deadline()));
+        }
+
+        ///
+        /// Schedules a call of a function defined by the specified source. Does not block until the function returns
+        /// See execute_function(SourceRef, const std::string &, After, Arguments...)
+        /// \tparam After the type of the after callback, callable with the function's result as boost::python::object
+        /// \tparam Arguments the types of the function's positional arguments
+        /// \param source_id the ID of this script's source
+        /// \param function the name of the function to call
+        /// \param after a callback to be executed with the function's result before the GIL is released
+        /// \param arguments the function's positional arguments
+        /// \throw NoSuchSourceError if no source with the specified ID was registered
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a future that returns 'true' if the function returned
+        ///
+        template<typename After, typename... Arguments, typename std::enable_if<IsRunCallback<After>::value, int>::type = 0> std::future<bool> execute_function(const Source::Id &source_id, const std::string &function, After after, Arguments... arguments){
+            return execute_function(sources_.get_source(source_id), function, std::move(after), std::move(arguments)...);
+        }
+
+#if PYTHON_CPP_UTILITY_COROUTINES
+        ///
+        /// Creates an awaitable run of a script from the specified source, e.g. co_await system.run(source, before, after)
+        /// The script is scheduled when the coroutine awaits the run, the coroutine is resumed by the worker thread after the script and the after callback finished executing
+        /// Only available if built with C++20 coroutine support, see RunAwaitable
+        /// \tparam Before the type of the before callback, callable with the local dictionary as boost::python::object
+        /// \tparam After the type of the after callback, callable with the local dictionary as boost::python::object
+        /// \param source a reference to the script's source
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs
+        /// \param after a callback to be executed after the script runs but before the GIL is released
+        /// \return the awaitable run, awaiting it rethrows a ScriptError if the script raises a python error or either callback function throws an exception, or RunCancelledError if the run was cancelled
+        ///
+        template<typename Before = Run::NoCallback, typename After = Run::NoCallback, typename std::enable_if<IsRunCallback<Before>::value && IsRunCallback<After>::value, int>::type = 0> RunAwaitable run(SourceRef source, Before before = Before{}, After after = After{}){
+            return RunAwaitable{scheduler_, memory_pool_, Run::create<TypedRun<Before, After>>(memory_pool_, std::move(source), std::move(before), std::move(after), Run::Priority::NORMAL, Run::no_deadline())};
+        }
+
+        ///
+        /// Creates an awaitable run of a script from the specified source
+        /// See run(SourceRef, Before, After)
+        /// \tparam Before the type of the before callback, callable with the local dictionary as boost::python::object
+        /// \tparam After the type of the after callback, callable with the local dictionary as boost::python::object
+        /// \param source_id the ID of this script's source
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs
+        /// \param after a callback to be executed after the script runs but before the GIL is released
+        /// \throw NoSuchSourceError if no source with the specified ID was registered
+        /// \return the awaitable run
+        ///
+        template<typename Before = Run::NoCallback, typename After = Run::NoCallback, typename std::enable_if<IsRunCallback<Before>::value && IsRunCallback<After>::value, int>::type = 0> RunAwaitable run(const Source::Id &source_id, Before before = Before{}, After after = After{}){
+            return run(sources_.get_source(source_id), std::move(before), std::move(after));
+        }
+#endif
+
+        ///
+        /// Schedules a script to run from the specified source with a priority class and deadline. Does not block until the script finishes
+        /// Queued scripts of a higher priority class are started first, within a class the script with the earliest deadline is started first
+        /// Missing the deadline does not cancel the script. Priorities and deadlines are only honored by the scheduler's locked queue, see Scheduler::QueueType
+        /// The caller is responsible for concurrency and consistency of the data used in the callback functions at the moment of execution
+        /// \param source a reference to the script's source
+        /// \param priority the priority class of the script run
+        /// \param deadline the point in time the script should be started by
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs. Should be used to put objects into python's local dictionary for the script to use as arguments
+        /// \param after a callback to be executed after the script runs but before the GIL is released. Should be used to put objects to get the results of thes script out of python's local dictionary.
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a future that returns "true" when the script and the after callback has finished executing, will propagate a ScriptError if the script raises a python error or either callback function throws an exception
+        ///
+        std::future<bool> execute(SourceRef source, Run::Priority priority, Run::Deadline deadline = Run::no_deadline(), Run::BeforeCallback before = Run::BeforeCallback{[](boost::python::object) {}}, Run::AfterCallback after = Run::AfterCallback{[](boost::python::object) {}});
+
+        ///
+        /// Schedules a script to run from the specified source with the normal priority class and a deadline. Does not block until the script finishes
+        /// See execute(SourceRef, Run::Priority, Run::Deadline, Run::BeforeCallback, Run::AfterCallback)
+        /// \param source a reference to the script's source
+        /// \param deadline the point in time the script should be started by
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs
+        /// \param after a callback to be executed after the script runs but before the GIL is released
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a future that returns "true" when the script and the after callback has finished executing, will propagate a ScriptError if the script raises a python error or either callback function throws an exception
+        ///
+        std::future<bool> execute(SourceRef source, Run::Deadline deadline, Run::BeforeCallback before = Run::BeforeCallback{[](boost::python::object) {}}, Run::AfterCallback after = Run::AfterCallback{[](boost::python::object) {}});
+
+        ///
+        /// Schedules a script to run from the specified source with a priority class and deadline. Does not block until the script finishes
+        /// See execute(SourceRef, Run::Priority, Run::Deadline, Run::BeforeCallback, Run::AfterCallback)
+        /// \param source_id the ID of this script's source
+        /// \param priority the priority class of the script run
+        /// \param deadline the point in time the script should be started by
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs
+        /// \param after a callback to be executed after the script runs but before the GIL is released
+        /// \throw NoSuchSourceError if no source with the specified ID was registered
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a future that returns "true" when the script and the after callback has finished executing, will propagate a ScriptError if the script raises a python error or either callback function throws an exception
+        ///
+        std::future<bool> execute(const Source::Id &source_id, Run::Priority priority, Run::Deadline deadline = Run::no_deadline(), Run::BeforeCallback before = Run::BeforeCallback{[](boost::python::object) {}}, Run::AfterCallback after = Run::AfterCallback{[](boost::python::object) {}});
+
+        ///
+        /// Schedules a script to run from the specified source with the normal priority class and a deadline. Does not block until the script finishes
+        /// See execute(SourceRef, Run::Priority, Run::Deadline, Run::BeforeCallback, Run::AfterCallback)
+        /// \param source_id the ID of this script's source
+        /// \param deadline the point in time the script should be started by
+        /// \param before a callback to be executed while the GIL is acquired but before the script runs
+        /// \param after a callback to be executed after the script runs but before the GIL is released
+        /// \throw NoSuchSourceError if no source with the specified ID was registered
+        /// \throw ScriptError if the script could not be executed for whatever reason
+        /// \return a future that returns "true" when the script and the after callback has finished executing, will propagate a ScriptError if the script raises a python error or either callback function throws an exception
+        ///
+        std::future<bool> execute(const Source::Id &source_id, Run::Deadline deadline, Run::BeforeCallback before = Run::BeforeCallback{[](boost::python::object) {}}, Run::AfterCallback after = Run::AfterCallback{[](boost::python::object) {}});
+
         ///
         /// Schedules a script to run from the specified source. Blocks until the script finishes
         /// The caller is responsible for concurrency and consistency of the data used in the callback functions at the moment of execution
@@ -106,6 +420,91 @@ namespace PythonCppUtility {
         bool execute_and_wait(const Source::Id &source_id, Run::BeforeCallback before = Run::BeforeCallback{[](boost::python::object) {}}, Run::AfterCallback after = Run::AfterCallback{[](boost::python::object) {}});
 
 
+        ///
+        /// Schedules a script to run once for each of the inputs, back to back in the same worker thread. Does not block until the scripts finish
+        /// The GIL is held while the inputs are executed, it is only released and acquired again when the time slice expires, see BatchRun
+        /// The caller is responsible for concurrency and consistency of the data used in the callback functions at the moment of execution
+        /// \param source a reference to the script's source
+        /// \param items the before and after callbacks for each input
+        /// \param time_slice the maximum time the GIL is held before it is released to let other threads run
+        /// \throw ScriptError if the scripts could not be executed for whatever reason
+        /// \return a future that returns "true" when the scripts for all inputs have finished executing, will propagate the first ScriptError raised by any of them
+        ///
+        std::future<bool> execute_batch(SourceRef source, std::vector<BatchRun::Item> items, std::chrono::microseconds time_slice = BatchRun::default_time_slice);
+
+        ///
+        /// Schedules a script to run once for each of the inputs, back to back in the same worker thread. Does not block until the scripts finish
+        /// See execute_batch(SourceRef, std::vector<BatchRun::Item>, std::chrono::microseconds)
+        /// \param source_id the ID of this script's source
+        /// \param items the before and after callbacks for each input
+        /// \param time_slice the maximum time the GIL is held before it is released to let other threads run
+        /// \throw NoSuchSourceError if no source with the specified ID was registered
+        /// \throw ScriptError if the scripts could not be executed for whatever reason
+        /// \return a future that returns "true" when the scripts for all inputs have finished executing, will propagate the first ScriptError raised by any of them
+        ///
+        std::future<bool> execute_batch(const Source::Id &source_id, std::vector<BatchRun::Item> items, std::chrono::microseconds time_slice = BatchRun::default_time_slice);
+
+        ///
+        /// Schedules a script to run once for each of the inputs, back to back in the same worker thread. Does not block until the scripts finish
+        /// See execute_batch(SourceRef, std::vector<BatchRun::Item>, std::chrono::microseconds)
+        /// \param source a reference to the script's source
+        /// \param items the before and after callbacks for each input
+        /// \param time_slice the maximum time the GIL is held before it is released to let other threads run
+        /// \throw ScriptError if the scripts could not be executed for whatever reason
+        /// \return a future for each input, in the same order, that returns "true" when the script and the after callback for this input have finished executing
+        ///
+        std::vector<std::future<bool>> execute_batch_items(SourceRef source, std::vector<BatchRun::Item> items, std::chrono::microseconds time_slice = BatchRun::default_time_slice);
+
+        ///
+        /// Schedules a script to run once for each of the inputs, back to back in the same worker thread. Does not block until the scripts finish
+        /// See execute_batch(SourceRef, std::vector<BatchRun::Item>, std::chrono::microseconds)
+        /// \param source_id the ID of this script's source
+        /// \param items the before and after callbacks for each input
+        /// \param time_slice the maximum time the GIL is held before it is released to let other threads run
+        /// \throw NoSuchSourceError if no source with the specified ID was registered
+        /// \throw ScriptError if the scripts could not be executed for whatever reason
+        /// \return a future for each input, in the same order, that returns "true" when the script and the after callback for this input have finished executing
+        ///
+        std::vector<std::future<bool>> execute_batch_items(const Source::Id &source_id, std::vector<BatchRun::Item> items, std::chrono::microseconds time_slice = BatchRun::default_time_slice);
+
+        ///
+        /// Limits the number of queued runs, so overload is shed instead of growing the queue without bound
+        /// Runs that are rejected or dropped fail with QueueFullError, see Scheduler::OverflowPolicy
+        /// Should not be called concurrently with the execute_??? methods
+        /// \param max_depth the maximum number of queued runs over all priority classes, or 0 for an unbounded queue
+        /// \param policy what happens to runs submitted while the queue is full
+        /// \param block_timeout the maximum time the execute_??? methods block if the policy is Scheduler::OverflowPolicy::BLOCK, or zero to block until there is room
+        ///
+        void queue_limit(std::size_t max_depth, Scheduler::OverflowPolicy policy, std::chrono::steady_clock::duration block_timeout = std::chrono::steady_clock::duration::zero());
+
+        ///
+        /// Sets whether each sub-interpreter has it's own GIL, if the workers use sub-interpreters
+        /// Only python 3.12 and later support this, earlier versions ignore it and the sub-interpreters share a single GIL
+        /// All defined modules have to be multi interpreter safe, which modules defined with boost python are not, see ModuleDefinition::multi_interpreter_safe
+        /// Takes effect the next time start() is called
+        /// \param own_gil if set to true, scripts in different workers run in parallel. Defaults to false
+        ///
+        void own_gil(bool own_gil);
+
+        ///
+        /// \return true if each sub-interpreter is created with it's own GIL, false otherwise
+        ///
+        bool own_gil() const;
+
+        ///
+        /// Starts reloading file sources when their files change, see SourceManager::watch_files()
+        /// While the system runs with the main interpreter, the watcher's thread also compiles a reloaded source, so the next run of it does not have to
+        /// Runs that already started finish with the old code, runs started after the reload use the new code
+        /// \param on_reload an optional callback called by the watcher's thread after a source was reloaded and compiled, or failed to reload
+        /// \throw SourceWatchError if the files can not be watched
+        ///
+        void watch_sources(SourceManager::ReloadCallback on_reload = SourceManager::ReloadCallback{});
+
+        ///
+        /// Stops reloading file sources, blocks until a reload in progress finished
+        ///
+        void unwatch_sources();
+
         ///
         /// \return a reference to the script system's source manager
         ///
@@ -126,6 +525,22 @@ namespace PythonCppUtility {
         ///
         const ModuleManager &modules() const;
 
+        ///
+        /// \return the way worker threads use the python interpreter
+        ///
+        InterpreterMode interpreter_mode() const;
+
+        ///
+        /// \param priority a priority class
+        /// \return the number of scripts of the priority class that are waiting to be started
+        ///
+        std::size_t queue_depth(Run::Priority priority) const;
+
+        ///
+        /// \return a snapshot of the script system's counters
+        ///
+        Stats stats() const;
+
         ///
         /// Stops the interpreter if it is running and finalizes it
         ///
@@ -133,10 +548,33 @@ namespace PythonCppUtility {
 
     private:
         PyThreadState *main_thread_state_;
+        MemoryPoolRef memory_pool_;
         Scheduler scheduler_;
         SourceManager sources_;
         ModuleManager modules_;
+        InterpreterMode interpreter_mode_;
+        bool own_gil_;
+        std::vector<std::unique_ptr<SubInterpreter>> interpreters_;
+        std::vector<std::unique_ptr<WorkerProcess>> processes_;
         bool running_;
+        Watchdog watchdog_;
+        std::mutex lifecycle_mutex_;
+
+        std::future<bool> submit(Run *run);
+
+        RunHandle submit_cancellable(Run *run, std::chrono::steady_clock::duration timeout);
+
+        Completion submit_async(Run *run, Completion::Handler on_complete, Completion::Executor executor);
+
+        void start_main_interpreter_threads();
+
+        void start_sub_interpreters();
+
+        void stop_sub_interpreters();
+
+        void start_worker_processes();
+
+        void stop_worker_processes();
 
         ScriptSystem(const ScriptSystem &) = delete;
         ScriptSystem &operator=(const ScriptSystem &) = delete;
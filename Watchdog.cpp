@@ -0,0 +1,51 @@
+#include "Watchdog.h"
+
+using namespace PythonCppUtility;
+using namespace std;
+
+Watchdog::Watchdog() : mutex_(), condition_variable_(), expiries_(), stopping_(false), thread_(){}
+
+void Watchdog::watch(weak_ptr<RunControl> control, chrono::steady_clock::time_point expiry){
+    unique_lock<mutex> lock{mutex_};
+    if(!thread_.joinable()){
+        thread_ = thread{[this](){
+            this->cancel_expired_runs();
+        }};
+    }
+    bool earliest = expiries_.empty() || expiry < expiries_.begin()->first;
+    expiries_.insert(make_pair(expiry, move(control)));
+    if(earliest){
+        condition_variable_.notify_one();
+    }
+}
+
+void Watchdog::cancel_expired_runs(){
+    unique_lock<mutex> lock{mutex_};
+    while(!stopping_){
+        if(expiries_.empty()){
+            condition_variable_.wait(lock);
+        }else if(expiries_.begin()->first > chrono::steady_clock::now()){
+            condition_variable_.wait_until(lock, expiries_.begin()->first);
+        }else{
+            shared_ptr<RunControl> control = expiries_.begin()->second.lock();
+            expiries_.erase(expiries_.begin());
+            if(control){
+                // Interrupting a run may wait for the GIL, new runs can be watched in the meantime
+                lock.unlock();
+                control->cancel();
+                lock.lock();
+            }
+        }
+    }
+}
+
+Watchdog::~Watchdog(){
+    {
+        unique_lock<mutex> lock{mutex_};
+        stopping_ = true;
+        condition_variable_.notify_one();
+    }
+    if(thread_.joinable()){
+        thread_.join();
+    }
+}
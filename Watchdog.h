@@ -0,0 +1,60 @@
+///
+/// Contains a timer thread that cancels script runs which exceed their timeout
+///
+
+#ifndef PYTHON_CPP_UTILITY_WATCHDOG_H
+#define	PYTHON_CPP_UTILITY_WATCHDOG_H
+
+#include "RunHandle.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace PythonCppUtility {
+
+    ///
+    /// Cancels runs whose timeout expired, whether they are still queued or already executing
+    /// The timer thread is started by the first call to watch()
+    /// This type is thread safe
+    ///
+    class Watchdog {
+    public:
+
+        ///
+        /// Creates a watchdog without starting it's thread
+        ///
+        Watchdog();
+
+        ///
+        /// Cancels a run when it's timeout expires, unless it finished before
+        /// \param control the control of the run
+        /// \param expiry the point in time the run is cancelled at
+        ///
+        void watch(std::weak_ptr<RunControl> control, std::chrono::steady_clock::time_point expiry);
+
+        ///
+        /// Stops the timer thread, runs that are still watched are not cancelled
+        ///
+        ~Watchdog();
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable condition_variable_;
+        std::multimap<std::chrono::steady_clock::time_point, std::weak_ptr<RunControl>> expiries_;
+        bool stopping_;
+        std::thread thread_;
+
+        void cancel_expired_runs();
+
+        Watchdog(const Watchdog &) = delete;
+        Watchdog &operator=(const Watchdog &) = delete;
+    };
+
+}
+
+#endif	/* PYTHON_CPP_UTILITY_WATCHDOG_H */
+
@@ -0,0 +1,203 @@
+/*
+ * Benchmarks of the script system's throughput and latency
+ *
+ * Usage: python-cpp-util-bench [runs per benchmark] [max workers] [main|sub|process] [benchmark]
+ *
+ * Each benchmark is run with 1 up to max workers, by default the number of cores. Runs are submitted asynchronously with at most two runs
+ * per worker in flight, the latency of a run is measured from it's submission until it's completion handler is called
+ * The results are printed to stdout as a JSON array with one object per benchmark and worker count
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/python.hpp>
+
+#include "Script.h"
+
+using namespace PythonCppUtility;
+using namespace std;
+
+namespace{
+    int add(int first, int second){
+        return first + second;
+    }
+}
+
+BOOST_PYTHON_MODULE(BenchModule){
+    boost::python::def("add", add);
+}
+
+namespace{
+
+    struct Benchmark{
+        const char *name;
+        const char *code;
+        Run::BeforeCallback before;
+        bool in_worker_processes;
+    };
+
+    struct Result{
+        string benchmark;
+        size_t workers;
+        size_t runs;
+        size_t failures;
+        double ops_per_second;
+        LatencyHistogram::Snapshot latency;
+    };
+
+    struct Order{
+        int quantity;
+        double price;
+        string name;
+    };
+
+    const Binding<Order> &order_binding(){
+        static Binding<Order> binding;
+        static once_flag declared;
+        call_once(declared, [](){
+            binding.argument("quantity", &Order::quantity).argument("price", &Order::price).argument("name", &Order::name);
+        });
+        return binding;
+    }
+
+    vector<Benchmark> benchmarks(){
+        Run::BeforeCallback no_arguments = [](boost::python::object){};
+        return vector<Benchmark>{
+            Benchmark{"empty", "pass\n", no_arguments, true},
+            Benchmark{"cpu_loop", "result = 0\nfor i in range(10000):\n    result += i\n", no_arguments, true},
+            Benchmark{"native_call", "import BenchModule\nresult = 0\nfor i in range(100):\n    result = BenchModule.add(result, i)\n", no_arguments, true},
+            Benchmark{"large_arguments", "result = len(arguments)\n", [](boost::python::object locals){
+                boost::python::dict arguments;
+                for(int i = 0; i < 1000; ++i){
+                    arguments[i] = i;
+                }
+                locals["arguments"] = arguments;
+            }, true},
+            Benchmark{"buffer_arguments", "result = len(arguments)\n", [](boost::python::object locals){
+                static const vector<double> arguments(1000, 1.0);
+                locals["arguments"] = BufferView::of(arguments);
+            }, false},
+            Benchmark{"bound_arguments", "result = quantity * price\n", [](boost::python::object locals){
+                static const Order order{3, 2.5, "order"};
+                order_binding().put(order, locals);
+            }, true}
+        };
+    }
+
+    Result run(const Benchmark &benchmark, size_t workers, ScriptSystem::InterpreterMode mode, size_t runs){
+        ScriptSystem system{workers, mode};
+        system.modules().add_module("BenchModule", PyInit_BenchModule);
+        SourceRef source = system.sources().create_source(benchmark.name, string{benchmark.code});
+        system.start();
+
+        // Compiles the script in each worker and warms up the run pool
+        size_t failures = 0;
+        for(size_t i = 0; i < workers * 4; ++i){
+            try{
+                system.execute(source, benchmark.before).get();
+            }catch(...){
+                ++failures;
+            }
+        }
+
+        LatencyHistogram latency;
+        mutex in_flight_mutex;
+        condition_variable in_flight_changed;
+        size_t in_flight = 0;
+        size_t completed = 0;
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        for(size_t i = 0; i < runs; ++i){
+            {
+                unique_lock<mutex> lock{in_flight_mutex};
+                in_flight_changed.wait(lock, [&](){
+                    return in_flight < workers * 2;
+                });
+                ++in_flight;
+            }
+            chrono::steady_clock::time_point submitted = chrono::steady_clock::now();
+            system.execute_async(source, benchmark.before, Run::NoCallback{}, [&, submitted](exception_ptr error){
+                latency.record(chrono::steady_clock::now() - submitted);
+                unique_lock<mutex> lock{in_flight_mutex};
+                if(error){
+                    ++failures;
+                }
+                --in_flight;
+                ++completed;
+                in_flight_changed.notify_all();
+            });
+        }
+        {
+            unique_lock<mutex> lock{in_flight_mutex};
+            in_flight_changed.wait(lock, [&](){
+                return completed == runs;
+            });
+        }
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+        system.stop();
+        return Result{benchmark.name, workers, runs, failures, runs / elapsed.count(), latency.snapshot()};
+    }
+
+    double microseconds(chrono::nanoseconds duration){
+        return duration.count() / 1000.0;
+    }
+
+    void print(const vector<Result> &results, const char *mode){
+        cout << "[" << endl;
+        for(size_t i = 0; i < results.size(); ++i){
+            const Result &result = results[i];
+            cout << "  {\"benchmark\": \"" << result.benchmark << "\", \"mode\": \"" << mode << "\", \"workers\": " << result.workers
+                 << ", \"runs\": " << result.runs << ", \"failures\": " << result.failures << ", \"ops_per_sec\": " << result.ops_per_second
+                 << ", \"p50_us\": " << microseconds(result.latency.percentile(50)) << ", \"p99_us\": " << microseconds(result.latency.percentile(99))
+                 << ", \"p999_us\": " << microseconds(result.latency.percentile(99.9)) << ", \"max_us\": " << microseconds(result.latency.max) << "}"
+                 << (i + 1 < results.size() ? "," : "") << endl;
+        }
+        cout << "]" << endl;
+    }
+
+    size_t argument(int argc, const char **argv, int index, size_t default_value){
+        return index < argc ? strtoul(argv[index], nullptr, 10) : default_value;
+    }
+}
+
+int main(int argc, const char **argv){
+    size_t runs = argument(argc, argv, 1, 2000);
+    size_t max_workers = argument(argc, argv, 2, thread::hardware_concurrency() ? thread::hardware_concurrency() : 1);
+    const char *mode_name = argc > 3 ? argv[3] : "main";
+    const char *only = argc > 4 ? argv[4] : nullptr;
+
+    ScriptSystem::InterpreterMode mode = ScriptSystem::InterpreterMode::MAIN_INTERPRETER;
+    if(strcmp(mode_name, "sub") == 0){
+        mode = ScriptSystem::InterpreterMode::SUB_INTERPRETER_PER_WORKER;
+    }else if(strcmp(mode_name, "process") == 0){
+        mode = ScriptSystem::InterpreterMode::PROCESS_PER_WORKER;
+    }else if(strcmp(mode_name, "main") != 0){
+        cerr << "unknown interpreter mode " << mode_name << ", expected main, sub or process" << endl;
+        return 1;
+    }
+
+    vector<Result> results;
+    for(const Benchmark &benchmark : benchmarks()){
+        if(only && strcmp(only, benchmark.name) != 0){
+            continue;
+        }
+        // Buffer views can not be sent to worker processes, see BufferView
+        if(mode == ScriptSystem::InterpreterMode::PROCESS_PER_WORKER && !benchmark.in_worker_processes){
+            continue;
+        }
+        for(size_t workers = 1; workers <= max_workers; ++workers){
+            results.push_back(run(benchmark, workers, mode, runs));
+        }
+    }
+    print(results, mode_name);
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * Microbenchmark comparing the scheduler's task queues
+ *
+ * Usage: python-cpp-util-queue-bench [producers] [consumers] [tasks per producer] [capacity]
+ *
+ * Each queue type is measured through the Scheduler itself: producers submit runs that only count their execution, the scheduler's
+ * workers dequeue and execute them exactly as they do script runs. Runs are taken from a memory pool like the script system's runs,
+ * so no script is executed and the python interpreter is not started
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Scheduler.h"
+
+using namespace PythonCppUtility;
+using namespace std;
+
+namespace{
+
+    ///
+    /// A run that marks it's task as executed instead of running a script
+    ///
+    class CountingRun : public Run{
+    public:
+        CountingRun(SourceRef source, size_t *task, atomic<size_t> *executed, MemoryPoolRef pool) : Run(move(source), Priority::NORMAL, no_deadline(), move(pool)), task_(task), executed_(executed){}
+
+        void operator() () override{
+            ++*task_;
+            ++*executed_;
+            finish(exception_ptr{});
+        }
+
+    private:
+        size_t *task_;
+        atomic<size_t> *executed_;
+    };
+
+    void run(const char *name, Scheduler::QueueType queue_type, size_t producers, size_t consumers, size_t tasks_per_producer, size_t capacity){
+        MemoryPoolRef pool = make_shared<MemoryPool>();
+        SourceRef source = make_shared<BufferedSource>("queue_bench", string{});
+        Scheduler scheduler{consumers, false, queue_type, capacity, pool};
+        vector<size_t> tasks(producers * tasks_per_producer);
+        atomic<size_t> executed{0};
+        vector<thread> threads;
+
+        scheduler.start();
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        for(size_t i = 0; i < producers; ++i){
+            threads.emplace_back([&, i](){
+                for(size_t j = 0; j < tasks_per_producer; ++j){
+                    scheduler.submit(Run::create<CountingRun>(pool, source, &tasks[i * tasks_per_producer + j], &executed));
+                }
+            });
+        }
+        for(thread &producer : threads){
+            producer.join();
+        }
+        while(executed.load() != tasks.size()){
+            this_thread::yield();
+        }
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+        scheduler.stop();
+
+        for(size_t task : tasks){
+            if(task != 1){
+                cerr << name << ": task was not executed exactly once" << endl;
+                exit(1);
+            }
+        }
+        cout << name << ": " << static_cast<size_t>(tasks.size() / elapsed.count()) << " tasks/s (" << elapsed.count() << " s)" << endl;
+    }
+
+    size_t argument(int argc, const char **argv, int index, size_t default_value){
+        return index < argc ? strtoul(argv[index], nullptr, 10) : default_value;
+    }
+}
+
+int main(int argc, const char **argv){
+    size_t producers = argument(argc, argv, 1, 8);
+    size_t consumers = argument(argc, argv, 2, 4);
+    size_t tasks_per_producer = argument(argc, argv, 3, 200000);
+    size_t capacity = argument(argc, argv, 4, Scheduler::default_queue_capacity);
+
+    cout << producers << " producers, " << consumers << " consumers, " << tasks_per_producer << " tasks per producer, capacity " << capacity << endl;
+    run("locked", Scheduler::QueueType::LOCKED, producers, consumers, tasks_per_producer, capacity);
+    run("lock free", Scheduler::QueueType::LOCK_FREE, producers, consumers, tasks_per_producer, capacity);
+    run("work stealing", Scheduler::QueueType::WORK_STEALING, producers, consumers, tasks_per_producer, capacity);
+    return 0;
+}
@@ -6,10 +6,26 @@
  */
 
 #include <iostream>
+#include <fstream>
 #include <chrono>
 #include <thread>
+#include <vector>
+#include <array>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <stdexcept>
 #include <chrono>
 
+#if PYTHON_CPP_UTILITY_COROUTINES
+#include <coroutine>
+#endif
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 #include <boost/python.hpp>
 
 #include "Script.h"
@@ -35,6 +51,38 @@ BOOST_PYTHON_MODULE(TestModule){
         .def("increment", &TestType::increment);
 }
 
+///
+/// A directory for the files written by a test, it is removed with all of it's files when the test ends
+///
+struct TemporaryDirectory{
+    string path;
+
+    TemporaryDirectory(){
+        char name[] = "/tmp/python-cpp-util-test-XXXXXX";
+        if(!mkdtemp(name)){
+            throw runtime_error{"can not create a temporary directory"};
+        }
+        path = name;
+    }
+
+    string file(const string &name) const{
+        return path + "/" + name;
+    }
+
+    ~TemporaryDirectory(){
+        if(DIR *directory = opendir(path.c_str())){
+            while(dirent *entry = readdir(directory)){
+                string name{entry->d_name};
+                if(name != "." && name != ".."){
+                    remove(file(name).c_str());
+                }
+            }
+            closedir(directory);
+        }
+        rmdir(path.c_str());
+    }
+};
+
 void basic_test(){
     ScriptSystem system;
     
@@ -60,12 +108,1170 @@ void basic_test(){
     });
 }
 
+void compiled_code_cache_test(){
+    ScriptSystem system;
+
+    SourceRef source = system.sources().create_source("cached", string{"result = number * 2\n"});
+
+    system.start();
+
+    for(int i = 0; i < 3; ++i){
+        int result = 0;
+        system.execute_and_wait(source, [=](boost::python::object locals){
+            locals["number"] = i;
+        }, [&](boost::python::object locals){
+            result = boost::python::extract<int>(locals["result"]);
+        });
+        if(result != i * 2){
+            Test::fail("unexpected script result");
+        }
+    }
+    if(source->cache_misses() != 1 || source->cache_hits() != 2){
+        Test::fail("source should be compiled exactly once");
+    }
+}
+
+void bytecode_cache_test(){
+    TemporaryDirectory directory;
+    {
+        ofstream output{directory.file("bytecode_cache_test.py")};
+        output << "result = number + 1\n";
+    }
+    BytecodeCacheRef cache{new BytecodeCache{directory.path}};
+    for(int i = 0; i < 2; ++i){
+        ScriptSystem system;
+        system.sources().bytecode_cache(cache);
+        SourceRef source = system.sources().create_source_from_file(directory.file("bytecode_cache_test.py"));
+        system.start();
+        int result = 0;
+        system.execute_and_wait(source, [](boost::python::object locals){
+            locals["number"] = 41;
+        }, [&](boost::python::object locals){
+            result = boost::python::extract<int>(locals["result"]);
+        });
+        if(result != 42){
+            Test::fail("unexpected script result");
+        }
+    }
+    if(cache->misses() != 1 || cache->hits() != 1){
+        Test::fail("second run should load the code from the bytecode cache");
+    }
+}
+
+void released_buffer_test(){
+    TemporaryDirectory directory;
+    {
+        ofstream output{directory.file("released_buffer_test.py")};
+        output << "result = number * 3\n";
+    }
+    ScriptSystem system;
+    system.sources().retain_buffers(false);
+    SourceRef file_source = system.sources().create_source_from_file(directory.file("released_buffer_test.py"));
+    SourceRef buffered_source = system.sources().create_source("released_buffer", string{"result = number * 3\n"});
+    for(int i = 0; i < 2; ++i){
+        system.start();
+        int result = 0;
+        system.execute_and_wait(file_source, [](boost::python::object locals){
+            locals["number"] = 5;
+        }, [&](boost::python::object locals){
+            result = boost::python::extract<int>(locals["result"]);
+        });
+        if(result != 15){
+            Test::fail("unexpected script result");
+        }
+        try{
+            system.execute_and_wait(buffered_source, [](boost::python::object locals){
+                locals["number"] = 5;
+            });
+            if(i != 0){
+                Test::fail("a released buffer can not be used after a restart");
+            }
+        }catch(BufferReleasedError &e){
+            if(i == 0){
+                Test::fail("buffer should not be released before the first run");
+            }
+        }
+        system.stop();
+    }
+
+    // Each sub-interpreter creates it's own python string, so the buffer has to be kept for the other workers
+    ScriptSystem sub_interpreters{2, ScriptSystem::InterpreterMode::SUB_INTERPRETER_PER_WORKER};
+    sub_interpreters.sources().retain_buffers(false);
+    SourceRef shared_source = sub_interpreters.sources().create_source("shared_buffer", string{"result = number * 3\n"});
+    sub_interpreters.start();
+    vector<future<bool>> futures;
+    for(int i = 0; i < 20; ++i){
+        futures.push_back(sub_interpreters.execute(shared_source, [](boost::python::object locals){
+            locals["number"] = 5;
+        }));
+    }
+    for(future<bool> &result : futures){
+        try{
+            result.get();
+        }catch(BufferReleasedError &e){
+            Test::fail("sources used by several sub-interpreters should keep their buffer");
+        }
+    }
+    sub_interpreters.stop();
+}
+
+void mapped_file_test(){
+    TemporaryDirectory directory;
+    {
+        // Exactly one page, the mapped code must still be null terminated
+        string code{"result = number - 1\n"};
+        code.append(static_cast<size_t>(sysconf(_SC_PAGESIZE)) - code.size() - 1, '#');
+        code.push_back('\n');
+        ofstream output{directory.file("mapped_file_test.py")};
+        output << code;
+    }
+    ScriptSystem system;
+    SourceRef source = system.sources().create_source_from_mapped_file(directory.file("mapped_file_test.py"));
+    system.start();
+    int result = 0;
+    system.execute_and_wait(source, [](boost::python::object locals){
+        locals["number"] = 8;
+    }, [&](boost::python::object locals){
+        result = boost::python::extract<int>(locals["result"]);
+    });
+    if(result != 7){
+        Test::fail("unexpected script result");
+    }
+}
+
+void sub_interpreter_test(){
+    ScriptSystem system{2, ScriptSystem::InterpreterMode::SUB_INTERPRETER_PER_WORKER};
+
+    string code{
+        "from TestModule import TestType\n"
+        "result = number + TestType().increment()\n"
+    };
+    SourceRef source = system.sources().create_source("sub_interpreter", code);
+    system.modules().add_module("TestModule", PyInit_TestModule);
+
+    for(int restart = 0; restart < 2; ++restart){
+        system.start();
+        vector<future<bool>> futures;
+        vector<int> results(16);
+        for(int i = 0; i < 16; ++i){
+            futures.push_back(system.execute(source, [=](boost::python::object locals){
+                locals["number"] = i;
+            }, [&results, i](boost::python::object locals){
+                results[i] = boost::python::extract<int>(locals["result"]);
+            }));
+        }
+        for(int i = 0; i < 16; ++i){
+            futures[i].get();
+            if(results[i] != i + 2){
+                Test::fail("unexpected script result");
+            }
+        }
+        system.stop();
+    }
+
+    // Boost python modules can not be imported in sub-interpreters with their own GIL, which only exist from python 3.12 on
+    system.own_gil(true);
+#if PY_VERSION_HEX >= 0x030C0000
+    try{
+        system.start();
+        Test::fail("modules that are not multi interpreter safe should be rejected");
+    }catch(SingleInterpreterModuleError &error){
+        if(error.id() != "TestModule"){
+            Test::fail("the error should name the rejected module");
+        }
+    }
+#else
+    system.start();
+    system.execute_and_wait(source, [](boost::python::object locals){
+        locals["number"] = 1;
+    });
+    system.stop();
+#endif
+}
+
+void worker_process_test(){
+    ScriptSystem system{2, ScriptSystem::InterpreterMode::PROCESS_PER_WORKER};
+
+    string code{
+        "import os\n"
+        "from TestModule import TestType\n"
+        "test_object = TestType()\n"
+        "result = [number + test_object.increment(), os.getpid()]\n"
+    };
+    SourceRef source = system.sources().create_source("worker_process", code);
+    SourceRef failing_source = system.sources().create_source("failing_worker_process", string{"raise ValueError('expected')\n"});
+    system.modules().add_module("TestModule", PyInit_TestModule);
+
+    system.start();
+    vector<future<bool>> futures;
+    vector<int> results(16);
+    vector<int> process_ids(16);
+    for(int i = 0; i < 16; ++i){
+        futures.push_back(system.execute(source, [=](boost::python::object locals){
+            locals["number"] = i;
+        }, [&results, &process_ids, i](boost::python::object locals){
+            results[i] = boost::python::extract<int>(locals["result"][0]);
+            process_ids[i] = boost::python::extract<int>(locals["result"][1]);
+        }));
+    }
+    for(int i = 0; i < 16; ++i){
+        futures[i].get();
+        if(results[i] != i + 2){
+            Test::fail("unexpected script result");
+        }
+        if(process_ids[i] == static_cast<int>(getpid())){
+            Test::fail("script should run in a worker process");
+        }
+    }
+    try{
+        system.execute_and_wait(failing_source);
+        Test::fail("python errors should be propagated from the worker process");
+    }catch(RemoteScriptError &e){
+    }
+
+    // A thread left running by a script keeps the worker process from exiting, it is killed once the stop timeout expired
+    SourceRef lingering_source = system.sources().create_source("lingering_worker_process", string{"import threading, time\nthreading.Thread(target=time.sleep, args=(60,)).start()\n"});
+    system.stop();
+    system.start();
+    system.execute_and_wait(lingering_source);
+    chrono::steady_clock::time_point stop_start = chrono::steady_clock::now();
+    system.stop();
+    if(chrono::steady_clock::now() - stop_start > WorkerProcess::stop_timeout * 10){
+        Test::fail("stopping should not wait for worker processes that do not exit");
+    }
+}
+
+void lock_free_queue_test(){
+    BoundedQueue<int> queue{3};
+    if(queue.capacity() != 4){
+        Test::fail("queue capacity should be rounded up to a power of two");
+    }
+    for(int i = 0; i < 4; ++i){
+        if(!queue.try_push(i)){
+            Test::fail("queue should accept elements up to it's capacity");
+        }
+    }
+    if(queue.try_push(4)){
+        Test::fail("full queue should reject elements");
+    }
+    int value = -1;
+    if(!queue.try_pop(value) || value != 0){
+        Test::fail("queue should be first in, first out");
+    }
+
+    ScriptSystem system{4, ScriptSystem::InterpreterMode::MAIN_INTERPRETER, Scheduler::QueueType::LOCK_FREE};
+    SourceRef source = system.sources().create_source("lock_free_queue", string{"result = number * 2\n"});
+
+    // Submitting more scripts than the ring holds while stopped fills the overflow list
+    const int count = 3000;
+    vector<future<bool>> futures;
+    vector<int> results(count);
+    for(int i = 0; i < count; ++i){
+        futures.push_back(system.execute(source, [=](boost::python::object locals){
+            locals["number"] = i;
+        }, [&results, i](boost::python::object locals){
+            results[i] = boost::python::extract<int>(locals["result"]);
+        }));
+    }
+    system.start();
+    vector<thread> producers;
+    vector<future<bool>> produced(count);
+    for(int t = 0; t < 4; ++t){
+        producers.emplace_back([&, t](){
+            for(int i = t; i < count; i += 4){
+                produced[i] = system.execute(source, [=](boost::python::object locals){
+                    locals["number"] = i;
+                });
+            }
+        });
+    }
+    for(thread &producer : producers){
+        producer.join();
+    }
+    for(int i = 0; i < count; ++i){
+        futures[i].get();
+        produced[i].get();
+        if(results[i] != i * 2){
+            Test::fail("unexpected script result");
+        }
+    }
+    system.stop();
+}
+
+void work_stealing_test(){
+    ScriptSystem system{4, ScriptSystem::InterpreterMode::MAIN_INTERPRETER, Scheduler::QueueType::WORK_STEALING};
+    SourceRef source = system.sources().create_source("work_stealing", string{"result = number + 1\n"});
+
+    system.start();
+    const int count = 64;
+    vector<future<bool>> futures;
+    vector<int> results(count * 2);
+    mutex nested_mutex;
+    vector<future<bool>> nested_futures;
+    for(int i = 0; i < count; ++i){
+        futures.push_back(system.execute(source, [=](boost::python::object locals){
+            locals["number"] = i;
+        }, [&, i](boost::python::object locals){
+            results[i] = boost::python::extract<int>(locals["result"]);
+            // Runs submitted by a worker go to it's own deque and may be stolen by the others
+            future<bool> nested = system.execute(source, [=](boost::python::object locals){
+                locals["number"] = count + i;
+            }, [&, i](boost::python::object locals){
+                results[count + i] = boost::python::extract<int>(locals["result"]);
+            });
+            lock_guard<mutex> lock{nested_mutex};
+            nested_futures.push_back(move(nested));
+        }));
+    }
+    for(future<bool> &result : futures){
+        result.get();
+    }
+    {
+        lock_guard<mutex> lock{nested_mutex};
+        for(future<bool> &result : nested_futures){
+            result.get();
+        }
+    }
+    for(int i = 0; i < count * 2; ++i){
+        if(results[i] != i + 1){
+            Test::fail("unexpected script result");
+        }
+    }
+    system.stop();
+}
+
+void priority_test(){
+    ScriptSystem system{1};
+    SourceRef source = system.sources().create_source("priority", string{"result = number\n"});
+
+    // Queued while stopped, so the single worker sees all of them at once
+    vector<int> order;
+    auto record = [&order](boost::python::object locals){
+        order.push_back(boost::python::extract<int>(locals["result"]));
+    };
+    auto number = [](int i){
+        return [=](boost::python::object locals){
+            locals["number"] = i;
+        };
+    };
+    Run::Deadline now = chrono::steady_clock::now();
+    vector<future<bool>> futures;
+    futures.push_back(system.execute(source, Run::Priority::LOW, Run::no_deadline(), number(4), record));
+    futures.push_back(system.execute(source, number(3), record));
+    futures.push_back(system.execute(source, now + chrono::seconds{2}, number(2), record));
+    futures.push_back(system.execute(source, now + chrono::seconds{1}, number(1), record));
+    futures.push_back(system.execute(source, Run::Priority::HIGH, Run::no_deadline(), number(0), record));
+    if(system.queue_depth(Run::Priority::HIGH) != 1 || system.queue_depth(Run::Priority::NORMAL) != 3 || system.queue_depth(Run::Priority::LOW) != 1){
+        Test::fail("unexpected queue depth");
+    }
+
+    system.start();
+    for(future<bool> &result : futures){
+        result.get();
+    }
+    for(int i = 0; i < 5; ++i){
+        if(order[i] != i){
+            Test::fail("runs should be executed by priority class and deadline");
+        }
+    }
+    if(system.queue_depth(Run::Priority::NORMAL) != 0){
+        Test::fail("queue depth should drop when runs are started");
+    }
+    system.stop();
+}
+
+void batch_test(){
+    ScriptSystem system;
+    SourceRef source = system.sources().create_source("batch", string{"result = number + 1\n"});
+    system.start();
+
+    const int count = 1000;
+    vector<int> results(count);
+    vector<BatchRun::Item> items;
+    for(int i = 0; i < count; ++i){
+        items.emplace_back([=](boost::python::object locals){
+            if(i == 10){
+                locals["number"] = "not a number";
+            }else{
+                locals["number"] = i;
+            }
+        }, [&results, i](boost::python::object locals){
+            results[i] = boost::python::extract<int>(locals["result"]);
+        });
+    }
+
+    vector<future<bool>> futures = system.execute_batch_items(source, items, chrono::microseconds{100});
+    for(int i = 0; i < count; ++i){
+        try{
+            futures[i].get();
+            if(i == 10){
+                Test::fail("errors should be propagated to the failing item's future");
+            }
+        }catch(boost::python::error_already_set &e){
+            if(i != 10){
+                Test::fail("only the failing item should raise an error");
+            }
+        }
+        if(i != 10 && results[i] != i + 1){
+            Test::fail("unexpected script result");
+        }
+    }
+
+    try{
+        system.execute_batch(source, items).get();
+        Test::fail("the aggregate future should propagate the first error");
+    }catch(boost::python::error_already_set &e){
+    }
+    system.stop();
+}
+
+void run_pool_test(){
+    ScriptSystem system{2};
+    SourceRef source = system.sources().create_source("run_pool", string{"result = number\n"});
+
+    // Each round queues all runs while stopped and stopping waits for the workers to destroy them, so every round needs the same number of blocks
+    auto execute_round = [&](){
+        vector<future<bool>> futures;
+        for(int i = 0; i < 50; ++i){
+            futures.push_back(system.execute(source, [=](boost::python::object locals){
+                locals["number"] = i;
+            }));
+        }
+        // Batch runs are taken from the same pool
+        futures.push_back(system.execute_batch(source, vector<BatchRun::Item>(4, BatchRun::Item{[](boost::python::object locals){
+            locals["number"] = 1;
+        }, [](boost::python::object){}})));
+        system.start();
+        for(future<bool> &result : futures){
+            result.get();
+        }
+        system.stop();
+    };
+    execute_round();
+    size_t warm_allocations = system.stats().heap_allocations;
+    if(warm_allocations == 0){
+        Test::fail("the pool should have allocated the first runs from the heap");
+    }
+    for(int round = 0; round < 3; ++round){
+        execute_round();
+    }
+    if(system.stats().heap_allocations != warm_allocations){
+        Test::fail("runs should be recycled once the pool has warmed up");
+    }
+}
+
+void typed_run_test(){
+    ScriptSystem system;
+    SourceRef source = system.sources().create_source("typed_run", string{"result = sum(numbers)\n"});
+    system.start();
+
+    // A capture larger than std::function's small object buffer is stored inside the run itself
+    array<int, 16> numbers;
+    for(int i = 0; i < 16; ++i){
+        numbers[i] = i;
+    }
+    int result = 0;
+    system.execute(source, [numbers](boost::python::object locals){
+        boost::python::list list;
+        for(int number : numbers){
+            list.append(number);
+        }
+        locals["numbers"] = list;
+    }, [&result](boost::python::object locals){
+        result = boost::python::extract<int>(locals["result"]);
+    }).get();
+    if(result != 120){
+        Test::fail("unexpected script result");
+    }
+
+    // Type erased callbacks still use the std::function overloads
+    Run::BeforeCallback before = [](boost::python::object locals){
+        boost::python::list list;
+        list.append(1);
+        locals["numbers"] = list;
+    };
+    Run::AfterCallback after = [&result](boost::python::object locals){
+        result = boost::python::extract<int>(locals["result"]);
+    };
+    system.execute(source, Run::Priority::HIGH, Run::no_deadline(), before, after).get();
+    if(result != 1){
+        Test::fail("unexpected script result");
+    }
+    system.stop();
+}
+
+void async_test(){
+    ScriptSystem system{2};
+    SourceRef source = system.sources().create_source("async", string{"result = number * 3\n"});
+    SourceRef failing_source = system.sources().create_source("failing_async", string{"raise ValueError('expected')\n"});
+    system.start();
+
+    // Many runs in flight without a waiting thread each, only this thread waits for the last continuation
+    const int count = 200;
+    atomic<int> sum{0};
+    atomic<int> completed{0};
+    atomic<int> failures{0};
+    promise<void> all_completed;
+    for(int i = 0; i < count; ++i){
+        system.execute_async(source, [=](boost::python::object locals){
+            locals["number"] = i;
+        }, [&sum](boost::python::object locals){
+            sum += boost::python::extract<int>(locals["result"])();
+        }, [&](exception_ptr error){
+            if(error){
+                ++failures;
+            }
+        }).then([&](exception_ptr){
+            if(++completed == count){
+                all_completed.set_value();
+            }
+        });
+    }
+    all_completed.get_future().get();
+    if(failures != 0){
+        Test::fail("runs should succeed");
+    }
+    if(sum != 3 * count * (count - 1) / 2){
+        Test::fail("unexpected script result");
+    }
+
+    // Errors are passed to the handler and continuations run on the executor
+    promise<bool> failed;
+    vector<function<void ()>> executed;
+    mutex executed_mutex;
+    Completion::Executor executor = [&](function<void ()> task){
+        lock_guard<mutex> lock{executed_mutex};
+        executed.push_back(task);
+    };
+    Completion completion = system.execute_async(failing_source, Run::NoCallback{}, Run::NoCallback{}, [&](exception_ptr error){
+        failed.set_value(static_cast<bool>(error));
+        throw runtime_error{"handler error"};
+    }, executor);
+    while(!completion.done()){
+        {
+            lock_guard<mutex> lock{executed_mutex};
+            for(function<void ()> &task : executed){
+                task();
+            }
+            executed.clear();
+        }
+        this_thread::yield();
+    }
+    if(!failed.get_future().get()){
+        Test::fail("the script error should be passed to the completion handler");
+    }
+    bool handler_error = false;
+    completion.then([&](exception_ptr error){
+        handler_error = static_cast<bool>(error);
+    });
+    if(!handler_error){
+        Test::fail("exceptions thrown by a handler should be passed on to it's continuations");
+    }
+    system.stop();
+}
+
+void cancellation_test(){
+    ScriptSystem system;
+    SourceRef source = system.sources().create_source("cancellation", string{"result = number\n"});
+    SourceRef runaway_source = system.sources().create_source("runaway", string{"while True:\n    pass\n"});
+    auto set_number = [](boost::python::object locals){
+        locals["number"] = 1;
+    };
+
+    // Queued runs are removed from the queue right away
+    RunHandle queued = system.execute_cancellable(source, chrono::steady_clock::duration::zero(), set_number);
+    if(!queued.cancel() || system.queue_depth(Run::Priority::NORMAL) != 0){
+        Test::fail("a queued run should be removed from the queue");
+    }
+    try{
+        queued.get();
+        Test::fail("a cancelled run should fail with RunCancelledError");
+    }catch(RunCancelledError &e){
+    }
+
+    // A runaway script is interrupted by it's timeout and the worker is free for the next run
+    system.start();
+    RunHandle timed_out = system.execute_cancellable(runaway_source, chrono::milliseconds{100}, Run::NoCallback{});
+    try{
+        timed_out.get();
+        Test::fail("a runaway script should be interrupted by it's timeout");
+    }catch(RunCancelledError &e){
+    }
+    if(!system.execute(source, set_number).get()){
+        Test::fail("the worker should be available after an interruption");
+    }
+
+    // A running script is interrupted by it's handle
+    atomic<bool> started{false};
+    RunHandle running = system.execute_cancellable(runaway_source, chrono::steady_clock::duration::zero(), [&started](boost::python::object){
+        started = true;
+    });
+    while(!started){
+        this_thread::yield();
+    }
+    this_thread::sleep_for(chrono::milliseconds{20});
+    if(!running.cancel()){
+        Test::fail("a running script should be interrupted");
+    }
+    try{
+        running.get();
+        Test::fail("an interrupted run should fail with RunCancelledError");
+    }catch(RunCancelledError &e){
+    }
+
+    // A run whose source fails to load must not interrupt the next script run by it's worker when it's timeout expires
+    SourceRef missing_source = system.sources().create_source_from_file("missing_cancellation.py", true);
+    SourceRef slow_source = system.sources().create_source("slow", string{"import time\ntime.sleep(0.5)\n"});
+    RunHandle failed = system.execute_cancellable(missing_source, chrono::milliseconds{200}, Run::NoCallback{});
+    try{
+        failed.get();
+        Test::fail("a run with a missing file should fail");
+    }catch(FileLoadError &e){
+    }
+    try{
+        system.execute(slow_source).get();
+    }catch(boost::python::error_already_set &e){
+        Test::fail("the timeout of a failed run should not interrupt the next script");
+    }
+
+    // Finished runs can not be cancelled anymore
+    RunHandle finished = system.execute_cancellable(source, chrono::seconds{10}, set_number);
+    if(!finished.get() || finished.cancel()){
+        Test::fail("a finished run should not be cancelled");
+    }
+    system.stop();
+}
+
+void queue_limit_test(){
+    ScriptSystem system;
+    SourceRef source = system.sources().create_source("queue_limit", string{"result = 1\n"});
+    auto expect_queue_full = [](future<bool> &result, const char *message){
+        try{
+            result.get();
+            Test::fail(message);
+        }catch(QueueFullError &e){
+        }
+    };
+
+    // The system is not started, so submitted runs stay queued
+    system.queue_limit(2, Scheduler::OverflowPolicy::REJECT);
+    vector<future<bool>> futures;
+    for(int i = 0; i < 3; ++i){
+        futures.push_back(system.execute(source));
+    }
+    expect_queue_full(futures[2], "a run submitted to a full queue should be rejected");
+    if(system.stats().rejected_runs != 1 || system.stats().queued_runs != 2){
+        Test::fail("the rejected run should be counted and not queued");
+    }
+    vector<future<bool>> batch_items = system.execute_batch_items(source, vector<BatchRun::Item>(2, BatchRun::Item{[](boost::python::object){}, [](boost::python::object){}}));
+    for(future<bool> &item : batch_items){
+        expect_queue_full(item, "the inputs of a rejected batch should fail with the reason it was rejected");
+    }
+
+    system.queue_limit(2, Scheduler::OverflowPolicy::DROP_OLDEST);
+    futures.push_back(system.execute(source));
+    expect_queue_full(futures[0], "the oldest run should be dropped to make room");
+    if(system.stats().dropped_runs != 1 || system.stats().queued_runs != 2){
+        Test::fail("the dropped run should be counted and replaced");
+    }
+
+    system.queue_limit(2, Scheduler::OverflowPolicy::BLOCK, chrono::milliseconds{20});
+    chrono::steady_clock::time_point submitted = chrono::steady_clock::now();
+    future<bool> blocked = system.execute(source);
+    if(chrono::steady_clock::now() - submitted < chrono::milliseconds{20}){
+        Test::fail("the submit should block until the timeout expires");
+    }
+    expect_queue_full(blocked, "a run that timed out waiting for room should be rejected");
+
+    // A blocked submit continues once a worker starts a queued run
+    system.queue_limit(2, Scheduler::OverflowPolicy::BLOCK);
+    thread starter{[&system](){
+        this_thread::sleep_for(chrono::milliseconds{20});
+        system.start();
+    }};
+    future<bool> unblocked = system.execute(source);
+    starter.join();
+    if(!unblocked.get() || !futures[1].get() || !futures[3].get()){
+        Test::fail("queued runs should be executed");
+    }
+    system.stop();
+}
+
+void latency_test(){
+    LatencyHistogram histogram;
+    for(int i = 1; i <= 1000; ++i){
+        histogram.record(chrono::microseconds{i});
+    }
+    LatencyHistogram::Snapshot snapshot = histogram.snapshot();
+    chrono::nanoseconds median = snapshot.percentile(50);
+    if(snapshot.count != 1000 || snapshot.max != chrono::microseconds{1000} || median < chrono::microseconds{500} || median > chrono::microseconds{563}){
+        Test::fail("the histogram should record durations with bounded relative error");
+    }
+
+    ScriptSystem system;
+    SourceRef source = system.sources().create_source("latency", string{"result = 1\n"});
+    SourceRef failing_source = system.sources().create_source("failing_latency", string{"raise ValueError('expected')\n"});
+    system.start();
+    for(int i = 0; i < 20; ++i){
+        system.execute(source, [](boost::python::object){
+            this_thread::sleep_for(chrono::milliseconds{1});
+        }).get();
+    }
+    try{
+        system.execute(failing_source).get();
+    }catch(boost::python::error_already_set &e){
+    }
+    ScriptSystem::Stats stats = system.stats();
+    const RunLatencySnapshot &latencies = stats.latencies.at("latency");
+    if(latencies.queued.count != 20 || latencies.execution.count != 20 || latencies.total.count != 20){
+        Test::fail("every successful run should be recorded once per phase");
+    }
+    if(latencies.before.percentile(50) < chrono::milliseconds{1} || latencies.total.percentile(99) < latencies.before.percentile(50)){
+        Test::fail("the phases should add up to the total latency");
+    }
+    if(stats.latencies.at("failing_latency").total.count != 0){
+        Test::fail("failed runs should not be recorded");
+    }
+    system.stop();
+}
+
+void gil_profiler_test(){
+    ScriptSystem system{2};
+    SourceRef source = system.sources().create_source("gil_profiler", string{"result = 1\n"});
+    system.start();
+    vector<future<bool>> futures;
+    for(int i = 0; i < 20; ++i){
+        futures.push_back(system.execute(source));
+    }
+    for(future<bool> &result : futures){
+        result.get();
+    }
+    {
+        GILGuard gil_guard{"gil_profiler_test"};
+        this_thread::sleep_for(chrono::milliseconds{2});
+    }
+    system.stop();
+
+    GILProfiler::Report report = GILProfiler::report();
+    if(!GILProfiler::enabled()){
+        if(!report.sites.empty() || !report.threads.empty()){
+            Test::fail("nothing should be recorded if the profiler is disabled");
+        }
+        return;
+    }
+    const GILProfiler::SiteStats *runs = nullptr;
+    const GILProfiler::SiteStats *test = nullptr;
+    for(const GILProfiler::SiteStats &site : report.sites){
+        if(site.site == "TypedRun"){
+            runs = &site;
+        }else if(site.site == "gil_profiler_test"){
+            test = &site;
+        }
+    }
+    if(!runs || runs->wait.count < 20 || !test || test->hold.count != 1 || test->hold.max < chrono::milliseconds{2}){
+        Test::fail("the guards should be recorded per call site");
+    }
+    if(report.threads.size() < 2 || report.to_string().find("TypedRun") == string::npos){
+        Test::fail("the guards should be recorded per thread and reported");
+    }
+}
+
+void module_namespace_test(){
+    ScriptSystem system;
+    SourceRef counting = system.sources().create_source("counting", string{"calls[0] += 1\nresult = calls[0]\n"});
+    SourceRef writing = system.sources().create_source("writing", string{"global shared\nshared = 1\n"});
+    SourceRef reading = system.sources().create_source("reading", string{"result = 'shared' in globals()\n"});
+    counting->setup_code("import math\ncalls = [0]\n");
+    system.start();
+
+    // The setup code runs once, every run of the source sees the same namespace
+    int result = 0;
+    auto read_result = [&result](boost::python::object locals){
+        result = boost::python::extract<int>(locals["result"]);
+    };
+    for(int i = 1; i <= 3; ++i){
+        system.execute(counting, Run::NoCallback{}, read_result).get();
+        if(result != i){
+            Test::fail("the setup code should run once per namespace");
+        }
+    }
+
+    // Globals written by one source are not visible to another
+    system.execute(writing).get();
+    system.execute(reading, Run::NoCallback{}, read_result).get();
+    if(result != 0){
+        Test::fail("sources should not share their namespace");
+    }
+
+    // New setup code replaces the namespace
+    counting->setup_code("calls = [10]\n");
+    system.execute(counting, Run::NoCallback{}, read_result).get();
+    if(result != 11){
+        Test::fail("the namespace should be created again with the new setup code");
+    }
+    system.stop();
+}
+
+void function_test(){
+    ScriptSystem system;
+    SourceRef functions = system.sources().create_source("functions", string{"loads = [0]\nloads[0] += 1\ndef add(first, second, name):\n    return (first + second, name.upper(), loads[0])\ndef count():\n    return loads[0]\n"});
+    system.start();
+
+    // The source is loaded once, each run only calls the function
+    for(int i = 0; i < 3; ++i){
+        double sum = 0;
+        string name;
+        int loads = 0;
+        system.execute_function(functions, "add", [&](boost::python::object result){
+            sum = boost::python::extract<double>(result[0]);
+            name = boost::python::extract<string>(result[1]);
+            loads = boost::python::extract<int>(result[2]);
+        }, i, 2.5, string{"value"}).get();
+        if(sum != i + 2.5 || name != "VALUE" || loads != 1){
+            Test::fail("the function should be called with the converted arguments in a module that is loaded once");
+        }
+    }
+    int loads = 0;
+    system.execute_function(functions, "count", [&loads](boost::python::object result){
+        loads = boost::python::extract<int>(result);
+    }).get();
+    if(loads != 1){
+        Test::fail("functions without arguments should be called in the same module");
+    }
+
+    // Functions that are not defined and python errors fail the run
+    bool failed = false;
+    try{
+        system.execute_function(functions, "missing", Run::NoCallback{}).get();
+    }catch(boost::python::error_already_set &){
+        failed = true;
+    }
+    if(!failed){
+        Test::fail("calling a function that is not defined should fail");
+    }
+    failed = false;
+    try{
+        system.execute_function(functions, "add", Run::NoCallback{}, 1).get();
+    }catch(boost::python::error_already_set &){
+        failed = true;
+    }
+    if(!failed){
+        Test::fail("a function raising a python error should fail the run");
+    }
+    system.stop();
+}
+
+void buffer_view_test(){
+    ScriptSystem system;
+    string reading_code{"result = (sum(samples) == 6.0 and samples.format == 'd' and samples.readonly and bytes(text) == b'abc')\noutput[1] = 42\n"};
+    SourceRef reading = system.sources().create_source("reading_buffers", reading_code);
+    SourceRef keeping = system.sources().create_source("keeping_buffers", string{"global kept\nresult = True\nif 'kept' in globals():\n    try:\n        kept[0]\n        result = False\n    except ValueError:\n        pass\nkept = samples\n"});
+    SourceRef slicing = system.sources().create_source("slicing_buffers", string{"global kept_slice\nkept_slice = samples[1:]\n"});
+    system.start();
+
+    vector<double> samples{1.0, 2.0, 3.0};
+    vector<int> output(2, 0);
+    string text{"abc"};
+    auto set_buffers = [&](boost::python::object locals){
+        locals["samples"] = BufferView::of(samples);
+        locals["output"] = BufferView::writable(output);
+        locals["text"] = BufferView::of(text);
+    };
+    bool result = false;
+    auto read_result = [&result](boost::python::object locals){
+        result = boost::python::extract<bool>(locals["result"]);
+    };
+    system.execute(reading, set_buffers, read_result).get();
+    if(!result || output[1] != 42){
+        Test::fail("scripts should read and write the C++ memory through the views");
+    }
+
+    // A view kept by the script is released when the run ends
+    system.execute(keeping, set_buffers).get();
+    system.execute(keeping, set_buffers, read_result).get();
+    if(!result){
+        Test::fail("a view kept after the run should be released");
+    }
+
+    // A slice can not be released, the run fails
+    bool failed = false;
+    try{
+        system.execute(slicing, set_buffers).get();
+    }catch(BufferExportedError &){
+        failed = true;
+    }
+    if(!failed){
+        Test::fail("a run whose script keeps a slice of a view should fail");
+    }
+
+    // Views can only be created by runs
+    failed = false;
+    try{
+        GILGuard gil_guard;
+        BufferView::of(samples);
+    }catch(ScriptError &){
+        failed = true;
+    }
+    if(!failed){
+        Test::fail("views should not be created outside of a run");
+    }
+    system.stop();
+
+    // Each sub-interpreter uses an exporter type of it's own
+    ScriptSystem sub_interpreters{2, ScriptSystem::InterpreterMode::SUB_INTERPRETER_PER_WORKER};
+    SourceRef sub_interpreter_reading = sub_interpreters.sources().create_source("sub_interpreter_reading_buffers", reading_code);
+    sub_interpreters.start();
+    vector<future<bool>> futures;
+    for(int i = 0; i < 8; ++i){
+        futures.push_back(sub_interpreters.execute(sub_interpreter_reading, set_buffers, read_result));
+    }
+    for(future<bool> &run : futures){
+        run.get();
+    }
+    if(!result){
+        Test::fail("scripts in sub-interpreters should read the C++ memory through the views");
+    }
+    sub_interpreters.stop();
+}
+
+struct BoundOrder{
+    int quantity;
+    double price;
+    string name;
+    vector<int> sizes;
+    double total;
+    string label;
+    vector<double> scaled;
+    bool large;
+};
+
+void binding_test(){
+    ScriptSystem system;
+    SourceRef pricing = system.sources().create_source("pricing", string{"total = quantity * price\nlabel = name.upper()\nscaled = [size * 0.5 for size in sizes]\nlarge = total > 100\n"});
+    SourceRef incomplete = system.sources().create_source("incomplete", string{"total = 1.0\n"});
+    system.start();
+
+    Binding<BoundOrder> binding;
+    binding.argument("quantity", &BoundOrder::quantity).argument("price", &BoundOrder::price).argument("name", &BoundOrder::name).argument("sizes", &BoundOrder::sizes);
+    binding.result("total", &BoundOrder::total).result("label", &BoundOrder::label).result("scaled", &BoundOrder::scaled).result("large", &BoundOrder::large);
+
+    for(int i = 1; i <= 3; ++i){
+        BoundOrder order{i * 20, 2.5, "order", vector<int>{2, 4}, 0.0, "", vector<double>{}, false};
+        system.execute(pricing, binding.before(order), binding.after(order)).get();
+        if(order.total != i * 50.0 || order.label != "ORDER" || order.scaled != vector<double>{1.0, 2.0} || order.large != (i > 2)){
+            Test::fail("the bound fields should be passed to the script and read from it's results");
+        }
+    }
+
+    // A missing result fails the run
+    BoundOrder order{1, 1.0, "", vector<int>{}, 0.0, "", vector<double>{}, false};
+    bool failed = false;
+    try{
+        system.execute(incomplete, binding.before(order), binding.after(order)).get();
+    }catch(boost::python::error_already_set &){
+        failed = true;
+    }
+    if(!failed){
+        Test::fail("a missing result should fail the run");
+    }
+    system.stop();
+}
+
+void worker_state_test(){
+    ScriptSystem system;
+    SourceRef counting = system.sources().create_source("thread_counting", string{"storage.count = getattr(storage, 'count', 0) + 1\nresult = storage.count\n"});
+    SourceRef identifying = system.sources().create_source("locals_identifying", string{"result = id(locals())\nstale = 'previous' in locals()\nprevious = True\n"});
+    counting->setup_code("import threading\nstorage = threading.local()\n");
+    system.start();
+
+    // Python's thread local data lives as long as the worker's thread state
+    long long result = 0;
+    bool stale = false;
+    auto read_result = [&](boost::python::object locals){
+        result = boost::python::extract<long long>(locals["result"]);
+        if(locals.contains("stale")){
+            stale = boost::python::extract<bool>(locals["stale"]);
+        }
+    };
+    for(int i = 1; i <= 3; ++i){
+        system.execute(counting, Run::NoCallback{}, read_result).get();
+        if(result != i){
+            Test::fail("the worker should keep it's thread state between runs");
+        }
+    }
+
+    // The local dictionary is cleared and reused by the next run, unless it is still referenced
+    system.execute(identifying, Run::NoCallback{}, read_result).get();
+    long long first = result;
+    system.execute(identifying, Run::NoCallback{}, read_result).get();
+    if(result != first || stale){
+        Test::fail("the worker should reuse the cleared local dictionary");
+    }
+    boost::python::object kept;
+    system.execute(identifying, Run::NoCallback{}, [&](boost::python::object locals){
+        read_result(locals);
+        kept = locals;
+    }).get();
+    system.execute(identifying, Run::NoCallback{}, read_result).get();
+    if(result == first || stale){
+        Test::fail("a local dictionary that is still referenced should not be reused");
+    }
+    {
+        GILGuard gil_guard;
+        kept = boost::python::object{};
+    }
+    system.stop();
+}
+
+void hot_reload_test(){
+    {
+        ofstream file{"hot_reload.py"};
+        file << "calls[0] += 1\nresult = 1\ncount = calls[0]\n";
+    }
+    ScriptSystem system;
+    SourceRef source = system.sources().create_source_from_file("hot_reload", string{"hot_reload.py"});
+    source->setup_code("calls = [0]\n");
+    system.start();
+    atomic<int> reloads{0};
+    system.watch_sources([&reloads](SourceRef, exception_ptr error){
+        if(!error){
+            ++reloads;
+        }
+    });
+
+    int result = 0;
+    int calls = 0;
+    auto read_result = [&](boost::python::object locals){
+        result = boost::python::extract<int>(locals["result"]);
+        calls = boost::python::extract<int>(locals["count"]);
+    };
+    system.execute(source, Run::NoCallback{}, read_result).get();
+    if(result != 1){
+        Test::fail("the file source should run the loaded code");
+    }
+
+    // Editors usually replace the file by renaming a new one
+    {
+        ofstream file{"hot_reload.py.new"};
+        file << "calls[0] += 1\nresult = 2\ncount = calls[0]\n";
+    }
+    rename("hot_reload.py.new", "hot_reload.py");
+    for(int i = 0; i < 500 && reloads == 0; ++i){
+        this_thread::sleep_for(chrono::milliseconds{10});
+    }
+    if(reloads == 0){
+        Test::fail("the changed file should be reloaded");
+    }
+    system.execute(source, Run::NoCallback{}, read_result).get();
+    if(result != 2 || calls != 2){
+        Test::fail("runs after the reload should use the new code and keep the source's namespace");
+    }
+    system.unwatch_sources();
+    system.stop();
+    remove("hot_reload.py");
+}
+
+#if PYTHON_CPP_UTILITY_COROUTINES
+struct TestCoroutine{
+    struct promise_type{
+        TestCoroutine get_return_object(){
+            return TestCoroutine{};
+        }
+
+        suspend_never initial_suspend() noexcept{
+            return suspend_never{};
+        }
+
+        suspend_never final_suspend() noexcept{
+            return suspend_never{};
+        }
+
+        void return_void(){}
+
+        void unhandled_exception(){
+            terminate();
+        }
+    };
+};
+
+TestCoroutine await_runs(ScriptSystem &system, SourceRef source, SourceRef failing_source, promise<int> &result){
+    int value = 0;
+    co_await system.run(source, [](boost::python::object locals){
+        locals["number"] = 20;
+    }, [&value](boost::python::object locals){
+        value = boost::python::extract<int>(locals["result"]);
+    });
+    try{
+        co_await system.run(failing_source);
+        value = -1;
+    }catch(boost::python::error_already_set &e){
+    }
+    result.set_value(value);
+}
+
+TestCoroutine await_cancelled_run(ScriptSystem &system, SourceRef source, promise<bool> &cancelled){
+    try{
+        co_await system.run(source);
+        cancelled.set_value(false);
+    }catch(RunCancelledError &e){
+        cancelled.set_value(true);
+    }
+}
+
+void coroutine_test(){
+    promise<bool> cancelled;
+    {
+        ScriptSystem system;
+        SourceRef source = system.sources().create_source("coroutine", string{"result = number + 1\n"});
+        SourceRef failing_source = system.sources().create_source("failing_coroutine", string{"raise ValueError('expected')\n"});
+        system.start();
+        promise<int> result;
+        await_runs(system, source, failing_source, result);
+        if(result.get_future().get() != 21){
+            Test::fail("the coroutine should receive the script result and the script error");
+        }
+        system.stop();
+
+        // Runs still queued when the system is destroyed resume their coroutine with RunCancelledError
+        await_cancelled_run(system, source, cancelled);
+    }
+    if(!cancelled.get_future().get()){
+        Test::fail("cancelled runs should propagate RunCancelledError");
+    }
+}
+#endif
 
 /*
  * 
  */
 int main(int argc, const char** argv) {
 	Test::add_test("basic", basic_test);
+	Test::add_test("compiled_code_cache", compiled_code_cache_test);
+	Test::add_test("bytecode_cache", bytecode_cache_test);
+	Test::add_test("released_buffer", released_buffer_test);
+	Test::add_test("mapped_file", mapped_file_test);
+	Test::add_test("sub_interpreter", sub_interpreter_test);
+	Test::add_test("worker_process", worker_process_test);
+	Test::add_test("lock_free_queue", lock_free_queue_test);
+	Test::add_test("work_stealing", work_stealing_test);
+	Test::add_test("priority", priority_test);
+	Test::add_test("batch", batch_test);
+	Test::add_test("run_pool", run_pool_test);
+	Test::add_test("typed_run", typed_run_test);
+	Test::add_test("async", async_test);
+	Test::add_test("cancellation", cancellation_test);
+	Test::add_test("queue_limit", queue_limit_test);
+	Test::add_test("latency", latency_test);
+	Test::add_test("gil_profiler", gil_profiler_test);
+	Test::add_test("module_namespace", module_namespace_test);
+	Test::add_test("function", function_test);
+	Test::add_test("buffer_view", buffer_view_test);
+	Test::add_test("binding", binding_test);
+	Test::add_test("worker_state", worker_state_test);
+	Test::add_test("hot_reload", hot_reload_test);
+#if PYTHON_CPP_UTILITY_COROUTINES
+	Test::add_test("coroutine", coroutine_test);
+#endif
 	return Test::test_main(argc, argv);
 }
 